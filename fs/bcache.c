@@ -0,0 +1,149 @@
+// Bounded cache of file data blocks.
+//
+// The blocks of regular files are mapped through here, and at most
+// BCACHE_NBLOCKS of them stay mapped at once.  When the cache is full,
+// a CLOCK sweep over the cached blocks picks a victim: a block whose
+// PTE_A bit is set has been used since the hand last passed and gets a
+// second chance, with PTE_A cleared; otherwise it is written back if
+// dirty and unmapped.  Metadata blocks (the superblock, the bitmap,
+// directories and indirect blocks) are mapped with map_block and never
+// evicted, since the rest of the server keeps pointers into them.
+//
+// Blocks that clients have mapped too can't be evicted: unmapping our
+// page would free nothing.  Clients map whole files, so if every
+// cached block is held like that, the cache grows past BCACHE_NBLOCKS,
+// and shrinks back once the blocks are let go.  So the cache has at
+// most BCACHE_NBLOCKS pages besides the ones clients hold.  Its table
+// of slots takes pages at BCACHE_TABVA as it grows, 4 bytes per slot;
+// it has no more slots than there are blocks on the disk.
+//
+// A block counts as cached only while its page is mapped with the
+// PTE_CACHED bit, so a slot whose block was unmapped behind our back
+// (by check_write_block, say) is simply free for reuse.
+
+#include "fs.h"
+
+// Where the table of slots lives, just past the IDE driver's PRD table
+#define BCACHE_TABVA	0xE0001000
+
+static uint32_t *const bc_blocks =		// block in each slot
+	(uint32_t *) BCACHE_TABVA;
+static uint32_t bc_nused;			// slots in use
+static uint32_t bc_hand;			// next slot CLOCK looks at
+
+struct Fsstats bcache_stats;
+
+// Is 'blockno' mapped through the cache?
+static bool
+bcache_holds(uint32_t blockno)
+{
+	return blockno != 0 && block_is_mapped(blockno)
+		&& (vpt[VPN(diskaddr(blockno))] & PTE_CACHED);
+}
+
+// Write 'blockno' back if it is dirty and still in use, and unmap it.
+static void
+bcache_evict(uint32_t blockno)
+{
+	if (block_is_dirty(blockno) && !block_is_free(blockno)) {
+		write_block(blockno);
+		bcache_stats.st_writebacks++;
+	}
+	unmap_block(blockno);
+	bcache_stats.st_evictions++;
+}
+
+// Run the CLOCK hand until it frees a slot, evicting its block if
+// need be.  Returns the slot, or -1 if every cached block is mapped by
+// a client as well.
+static int
+bcache_sweep(void)
+{
+	uint32_t i, slot, bno;
+	char *va;
+	int r;
+
+	// Two sweeps: the first clears the accessed bits it passes, so
+	// the second is sure to find a victim unless clients hold them all.
+	for (i = 0; i < 2 * bc_nused; i++) {
+		slot = bc_hand;
+		bc_hand = (bc_hand + 1) % bc_nused;
+		bno = bc_blocks[slot];
+		if (!bcache_holds(bno))
+			return slot;
+
+		va = diskaddr(bno);
+		if (pageref(va) > 1)
+			continue;
+		if (i < bc_nused && (vpt[VPN(va)] & PTE_A)) {
+			// Remapping the page clears PTE_A, but PTE_D too,
+			// so leave dirty blocks for the second sweep.
+			if (!va_is_dirty(va)
+			    && (r = sys_page_map(0, va, 0, va,
+						 vpt[VPN(va)] & PTE_USER)) < 0)
+				panic("bcache_sweep: sys_page_map: %e", r);
+			continue;
+		}
+		bcache_evict(bno);
+		return slot;
+	}
+	return -1;
+}
+
+// Add a slot at the end of the table, giving the table another page
+// if need be.
+// Returns the slot, or -E_NO_MEM if there is no memory for the page.
+static int
+bcache_grow(void)
+{
+	int r;
+	void *va;
+
+	va = &bc_blocks[bc_nused];
+	if (!va_is_mapped(va)
+	    && (r = sys_page_alloc(0, ROUNDDOWN(va, PGSIZE),
+				   PTE_P|PTE_U|PTE_W)) < 0)
+		return r;
+	return bc_nused++;
+}
+
+// Find a slot for a new block, evicting a cached block if need be.
+// Returns the slot, or -E_NO_MEM if there is none.
+static int
+bcache_slot(void)
+{
+	int slot;
+
+	if (bc_nused < BCACHE_NBLOCKS)
+		return bcache_grow();
+
+	// Shrink back to the limit if clients took us past it.
+	while (bc_nused > BCACHE_NBLOCKS && (slot = bcache_sweep()) >= 0) {
+		bc_blocks[slot] = bc_blocks[--bc_nused];
+		if (bc_hand >= bc_nused)
+			bc_hand = 0;
+	}
+
+	if ((slot = bcache_sweep()) >= 0)
+		return slot;
+	return bcache_grow();
+}
+
+// Allocate a page to hold file data block 'blockno' in the cache,
+// evicting another block if the cache is full.
+// Returns 0 on success, < 0 on error.
+int
+bcache_map(uint32_t blockno)
+{
+	int r, slot;
+
+	if (block_is_mapped(blockno))
+		return 0;
+	if ((slot = bcache_slot()) < 0)
+		return slot;
+	if ((r = sys_page_alloc(0, diskaddr(blockno),
+				PTE_U|PTE_P|PTE_W|PTE_CACHED)) < 0)
+		return r;
+	bc_blocks[slot] = blockno;
+	return 0;
+}
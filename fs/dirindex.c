@@ -0,0 +1,279 @@
+// Hashed directory index.
+//
+// dir_lookup used to compare a name with every entry in every block of
+// a directory.  On disks with FS_FEAT_DIRINDEX, a directory of more
+// than DIRINDEX_MIN blocks also has an index (struct Dirindex in
+// inc/fs.h) hung off its f_index, so a lookup reads one bucket block
+// and compares only the entries whose hash matches.  The entries stay
+// where they always were, so smaller directories, older disks, and
+// clients that read a directory as an array of Files don't notice.
+//
+// A bucket that fills up is split on its next hash bit, doubling the
+// table of buckets first if it is as deep as the table.  If a bucket
+// can't be split any more, or any other update fails, fs.c drops the
+// index and the directory goes back to being searched linearly.
+//
+// The index also remembers the lowest entry slot that may be free, so
+// that dir_alloc_file doesn't have to search for one either.
+//
+// Index blocks are metadata: they stay mapped once read, like the
+// indirect blocks, and are noted as belonging to the directory.
+
+#include <inc/string.h>
+
+#include "fs.h"
+
+// Set '*blk' to index block 'blockno', reading it in if need be.
+// Returns 0 on success, < 0 on error.
+static int
+dirindex_read(uint32_t blockno, void **blk)
+{
+	int r;
+	char *addr;
+
+	if (block_is_mapped(blockno))
+		addr = diskaddr(blockno);
+	else if ((r = read_block(blockno, &addr, 0)) < 0)
+		return r;
+	*blk = addr;
+	return 0;
+}
+
+// Set '*f' to the entry in slot 'slot' of directory 'dir'.
+static int
+dirindex_entry(struct File *dir, uint32_t slot, struct File **f)
+{
+	int r;
+	char *blk;
+
+	if ((r = file_get_block(dir, slot / BLKFILES, &blk)) < 0)
+		return r;
+	*f = (struct File *) blk + slot % BLKFILES;
+	return 0;
+}
+
+// Add the entry in slot 'slot', whose name hashes to 'h', to the index
+// of 'dir' rooted at block 'root', splitting buckets as need be.
+// Returns 0 on success, -E_NO_DISK if the entry's bucket is full and
+// can't be split any further, or another error.
+static int
+dirindex_insert(struct File *dir, uint32_t root, uint32_t h, uint32_t slot)
+{
+	int r;
+	uint32_t i, bit, bno, nbno;
+	struct Dirindex *di;
+	struct Dirbucket *db, *nb;
+
+	if ((r = dirindex_read(root, (void **) &di)) < 0)
+		return r;
+	for (;;) {
+		bno = di->di_buckets[h & DIRINDEX_MASK(di->di_depth)];
+		if ((r = dirindex_read(bno, (void **) &db)) < 0)
+			return r;
+		if (db->db_count < DIRBUCKET_NENTS) {
+			db->db_ents[db->db_count].de_hash = h;
+			db->db_ents[db->db_count].de_slot = slot;
+			db->db_count++;
+			dirty_note(bno, dir);
+			return 0;
+		}
+
+		if (db->db_depth == di->di_depth) {
+			if (di->di_depth == DIRINDEX_MAXDEPTH)
+				return -E_NO_DISK;
+			for (i = 0; i < (1 << di->di_depth); i++)
+				di->di_buckets[i + (1 << di->di_depth)] =
+					di->di_buckets[i];
+			di->di_depth++;
+		}
+
+		// Move the entries with the next hash bit set to a new
+		// bucket, and point the table's slots for them at it.
+		if ((r = alloc_block_near(bno + 1, 0)) < 0)
+			return r;
+		nbno = r;
+		nb = (struct Dirbucket *) diskaddr(nbno);
+		bit = 1 << db->db_depth;
+		db->db_depth++;
+		nb->db_depth = db->db_depth;
+		nb->db_count = 0;
+		for (i = 0; i < db->db_count; )
+			if (db->db_ents[i].de_hash & bit) {
+				nb->db_ents[nb->db_count++] = db->db_ents[i];
+				db->db_ents[i] = db->db_ents[--db->db_count];
+			} else
+				i++;
+		for (i = 0; i < (1 << di->di_depth); i++)
+			if (di->di_buckets[i] == bno && (i & bit))
+				di->di_buckets[i] = nbno;
+		dirty_note(root, dir);
+		dirty_note(bno, dir);
+		dirty_note(nbno, dir);
+	}
+}
+
+// Build an index of the entries of directory 'dir', near its first
+// block, and set '*root' to its root block.
+// Returns 0 on success, < 0 on error, having freed what it allocated.
+int
+dirindex_build(struct File *dir, uint32_t *root)
+{
+	int r;
+	uint32_t i, j, nblock, bno;
+	char *blk;
+	struct File *f;
+	struct Dirindex *di;
+	struct Dirbucket *db;
+
+	if ((r = alloc_block_near(dir->f_direct[0], 0)) < 0)
+		return r;
+	*root = r;
+	if ((r = alloc_block_near(*root + 1, 0)) < 0) {
+		free_block(*root);
+		return r;
+	}
+	bno = r;
+
+	nblock = dir->f_size / BLKSIZE;
+	di = (struct Dirindex *) diskaddr(*root);
+	di->di_depth = 0;
+	di->di_free = nblock * BLKFILES;
+	di->di_buckets[0] = bno;
+	db = (struct Dirbucket *) diskaddr(bno);
+	db->db_depth = 0;
+	db->db_count = 0;
+	dirty_note(*root, dir);
+	dirty_note(bno, dir);
+
+	for (i = 0; i < nblock; i++) {
+		if ((r = file_get_block(dir, i, &blk)) < 0)
+			goto fail;
+		f = (struct File *) blk;
+		for (j = 0; j < BLKFILES; j++)
+			if (f[j].f_name[0] == '\0')
+				di->di_free = MIN(di->di_free, i * BLKFILES + j);
+			else if ((r = dirindex_insert(dir, *root,
+						      dir_hash(f[j].f_name),
+						      i * BLKFILES + j)) < 0)
+				goto fail;
+	}
+	return 0;
+
+fail:
+	dirindex_free(*root);
+	return r;
+}
+
+// Free the blocks of the index rooted at block 'root'.
+void
+dirindex_free(uint32_t root)
+{
+	uint32_t i;
+	struct Dirindex *di;
+	struct Dirbucket *db;
+
+	if (dirindex_read(root, (void **) &di) == 0)
+		for (i = 0; i < (1 << di->di_depth); i++) {
+			// Several table slots can share a bucket; free it
+			// at the first of them.
+			if (dirindex_read(di->di_buckets[i], (void **) &db) == 0
+			    && i < (1 << db->db_depth))
+				free_block(di->di_buckets[i]);
+		}
+	free_block(root);
+}
+
+// Find the entry named 'name' in directory 'dir', which has an index.
+// Returns 0 and sets '*file' on success, -E_NOT_FOUND if there is no
+// such entry, or another error.
+int
+dirindex_lookup(struct File *dir, const char *name, struct File **file)
+{
+	int r;
+	uint32_t i, h;
+	struct File *f;
+	struct Dirindex *di;
+	struct Dirbucket *db;
+
+	if ((r = dirindex_read(dir->f_index, (void **) &di)) < 0)
+		return r;
+	h = dir_hash(name);
+	if ((r = dirindex_read(di->di_buckets[h & DIRINDEX_MASK(di->di_depth)],
+			       (void **) &db)) < 0)
+		return r;
+	for (i = 0; i < db->db_count; i++) {
+		if (db->db_ents[i].de_hash != h)
+			continue;
+		if ((r = dirindex_entry(dir, db->db_ents[i].de_slot, &f)) < 0)
+			return r;
+		if (strcmp(f->f_name, name) == 0) {
+			*file = f;
+			return 0;
+		}
+	}
+	return -E_NOT_FOUND;
+}
+
+// Add the newly filled-in entry in slot 'slot' of directory 'dir',
+// named 'name', to the directory's index.
+// Returns 0 on success, < 0 on error.
+int
+dirindex_add(struct File *dir, const char *name, uint32_t slot)
+{
+	int r;
+	struct Dirindex *di;
+
+	if ((r = dirindex_read(dir->f_index, (void **) &di)) < 0)
+		return r;
+	if (slot == di->di_free) {
+		di->di_free++;
+		dirty_note(dir->f_index, dir);
+	}
+	return dirindex_insert(dir, dir->f_index, dir_hash(name), slot);
+}
+
+// Take entry 'f' of directory 'dir', which is about to be cleared, out
+// of the directory's index.
+// Returns 0 on success, < 0 on error.
+int
+dirindex_remove(struct File *dir, struct File *f)
+{
+	int r;
+	uint32_t i, h, bno;
+	struct File *e;
+	struct Dirindex *di;
+	struct Dirbucket *db;
+
+	if ((r = dirindex_read(dir->f_index, (void **) &di)) < 0)
+		return r;
+	h = dir_hash(f->f_name);
+	bno = di->di_buckets[h & DIRINDEX_MASK(di->di_depth)];
+	if ((r = dirindex_read(bno, (void **) &db)) < 0)
+		return r;
+	for (i = 0; i < db->db_count; i++) {
+		if (db->db_ents[i].de_hash != h)
+			continue;
+		if ((r = dirindex_entry(dir, db->db_ents[i].de_slot, &e)) < 0)
+			return r;
+		if (e != f)
+			continue;
+		di->di_free = MIN(di->di_free, db->db_ents[i].de_slot);
+		db->db_ents[i] = db->db_ents[--db->db_count];
+		dirty_note(dir->f_index, dir);
+		dirty_note(bno, dir);
+		return 0;
+	}
+	return -E_NOT_FOUND;
+}
+
+// Return the lowest entry slot of directory 'dir', which has an index,
+// that may be free.
+uint32_t
+dirindex_free_slot(struct File *dir)
+{
+	struct Dirindex *di;
+
+	if (dirindex_read(dir->f_index, (void **) &di) < 0)
+		return 0;
+	return di->di_free;
+}
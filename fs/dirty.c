@@ -0,0 +1,141 @@
+// Set of blocks that may be dirty.
+//
+// fs_sync and file_flush used to check the PTE_D bit of every block on
+// the disk, or every block of the file.  Instead, whoever writes into a
+// block (or hands it out to be written, as file_get_block does) notes
+// it here, along with the file it belongs to, and the flushes look
+// only at the blocks noted.  A bitmap says which blocks are in the set
+// and a list holds them, so both noting and flushing are cheap.
+//
+// Closing a file doesn't write it out.  Instead the server's flusher
+// calls dirty_writeback periodically (see serve_flush), which writes
+// the blocks that have been in the set for DIRTY_AGE calls or more, so
+// bursts of writes to the same blocks cost one disk write between them.
+
+#include "fs.h"
+
+#define DIRTY_MAX	1024
+#define DIRTY_AGE	3
+
+struct Dirty {
+	uint32_t d_blockno;
+	struct File *d_owner;	// file the block belongs to, 0 if none
+	uint32_t d_epoch;	// dirty_epoch when noted
+};
+
+static uint32_t dirty_map[DISKSIZE / BLKSIZE / 32];
+static struct Dirty dirty_list[DIRTY_MAX];
+static uint32_t dirty_n;
+static uint32_t dirty_epoch;	// calls to dirty_writeback so far
+
+static bool
+dirty_has(uint32_t blockno)
+{
+	return (dirty_map[blockno / 32] & (1 << (blockno % 32))) != 0;
+}
+
+// Take entry 'i' out of the list, moving the last entry into its place.
+static void
+dirty_remove(uint32_t i)
+{
+	uint32_t blockno;
+
+	blockno = dirty_list[i].d_blockno;
+	dirty_map[blockno / 32] &= ~(1 << (blockno % 32));
+	dirty_list[i] = dirty_list[--dirty_n];
+}
+
+// Note that block 'blockno', which belongs to file 'owner' (0 for the
+// superblock and the bitmap), may have been written.
+void
+dirty_note(uint32_t blockno, struct File *owner)
+{
+	if (dirty_has(blockno))
+		return;
+	if (dirty_n == DIRTY_MAX)
+		dirty_flush_all();
+
+	dirty_map[blockno / 32] |= 1 << (blockno % 32);
+	dirty_list[dirty_n].d_blockno = blockno;
+	dirty_list[dirty_n].d_owner = owner;
+	dirty_list[dirty_n].d_epoch = dirty_epoch;
+	dirty_n++;
+}
+
+// Block 'blockno' has been freed: drop it from the set, so that its
+// next owner can claim it.
+void
+dirty_forget(uint32_t blockno)
+{
+	uint32_t i;
+
+	if (!dirty_has(blockno))
+		return;
+	for (i = 0; i < dirty_n; i++)
+		if (dirty_list[i].d_blockno == blockno) {
+			dirty_remove(i);
+			return;
+		}
+}
+
+// Write out the dirty blocks among the noted blocks that 'due' picks,
+// and take those out of the set.
+static void
+dirty_flush_if(bool (*due)(const struct Dirty *, const void *),
+	       const void *arg)
+{
+	uint32_t i, b;
+
+	for (i = 0; i < dirty_n; ) {
+		if (!due(&dirty_list[i], arg)) {
+			i++;
+			continue;
+		}
+		b = dirty_list[i].d_blockno;
+		if (block_is_dirty(b) && !block_is_free(b))
+			ioq_write(b);
+		dirty_remove(i);
+	}
+	ioq_flush();
+}
+
+static bool
+dirty_owned_by(const struct Dirty *d, const void *f)
+{
+	return d->d_owner == f;
+}
+
+static bool
+dirty_any(const struct Dirty *d, const void *unused)
+{
+	return 1;
+}
+
+static bool
+dirty_old(const struct Dirty *d, const void *unused)
+{
+	return dirty_epoch - d->d_epoch >= DIRTY_AGE;
+}
+
+// Write out the dirty blocks belonging to file 'f'.
+void
+dirty_flush(struct File *f)
+{
+	dirty_flush_if(dirty_owned_by, f);
+}
+
+// Write out every dirty block.
+void
+dirty_flush_all(void)
+{
+	dirty_flush_if(dirty_any, 0);
+}
+
+// Start a new write-back period, and write out the blocks that have
+// been in the set for DIRTY_AGE periods.
+void
+dirty_writeback(void)
+{
+	dirty_epoch++;
+	dirty_flush_if(dirty_old, 0);
+}
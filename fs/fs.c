@@ -6,7 +6,7 @@ struct Super *super;		// superblock
 uint32_t *bitmap;		// bitmap blocks mapped in memory
 
 void file_flush(struct File *f);
-bool block_is_free(uint32_t blockno);
+static uint32_t file_alloc_goal(struct File *f, uint32_t filebno);
 
 // Return the virtual address of this disk block.
 char*
@@ -60,10 +60,12 @@ map_block(uint32_t blockno)
 // Returns 0 on success, or a negative error code on error.
 // 
 // If blk != 0, set *blk to the address of the block in memory.
+// If cached is set, the block is file data and goes through the
+// bounded buffer cache; otherwise it stays mapped for good.
 //
 // Hint: Use diskaddr, map_block, and ide_read.
-static int
-read_block(uint32_t blockno, char **blk)
+int
+read_block(uint32_t blockno, char **blk, bool cached)
 {
 	int r;
 	char *addr;
@@ -75,7 +77,7 @@ read_block(uint32_t blockno, char **blk)
 		panic("reading free block %08x\n", blockno);
 
 	// LAB 5: Your code here.
-	r = map_block(blockno);
+	r = cached ? bcache_map(blockno) : map_block(blockno);
 	if (r)
 		return r;
 
@@ -90,30 +92,16 @@ read_block(uint32_t blockno, char **blk)
 	return sys_page_map(0, addr, 0, addr, vpt[VPN(addr)] & PTE_USER);
 }
 
-// Copy the current contents of the block out to disk.
-// Then clear the PTE_D bit using sys_page_map.
-// Hint: Use ide_write.
-// Hint: Use the PTE_USER constant when calling sys_page_map.
+// Copy the current contents of the block out to disk now, along with
+// any other writes queued (see ioq.c), and clear its PTE_D bit.
 void
 write_block(uint32_t blockno)
 {
-	int r;
-	char *addr;
-
 	if (!block_is_mapped(blockno))
 		panic("write unmapped block %08x", blockno);
-	
-	// Write the disk block and clear PTE_D.
-	// LAB 5: Your code here.
-
-	addr = diskaddr(blockno);
-	r = ide_write(blockno * BLKSECTS, addr, BLKSECTS);
-	if (r)
-		panic("write_block(): ide_write() failed: %e\n", r);
 
-	r = sys_page_map(0, addr, 0, addr, vpt[VPN(addr)] & PTE_USER);
-	if (r)
-		panic("write_block(): sys_page_map() failed: %e\n", r);
+	ioq_write(blockno);
+	ioq_flush();
 }
 
 // Make sure this block is unmapped.
@@ -152,47 +140,121 @@ free_block(uint32_t blockno)
 	if (blockno == 0)
 		panic("attempt to free zero block");
 	bitmap[blockno/32] |= 1<<(blockno%32);
+	dirty_forget(blockno);
+	dirty_note(blockno / BLKBITSIZE + 2, 0);
 }
 
-// Search the bitmap for a free block and allocate it.
-// 
+// Where alloc_block_num starts looking: just past the block it
+// allocated last, so that the search doesn't rescan the full part of
+// the disk every time.
+static uint32_t alloc_hint;
+
+// Search the bitmap for the first free block at or after 'goal',
+// wrapping around past the end of the disk, and allocate it.
+// The bitmap is scanned a word (32 blocks) at a time.  The bitmap
+// block is only marked dirty; it goes to disk with the next write-back.
+//
 // Return block number allocated on success,
 // -E_NO_DISK if we are out of blocks.
+static int
+alloc_block_num_near(uint32_t goal)
+{
+	uint32_t i, w, nwords, bno;
+	int r;
+
+	// Bits past the end of the disk are clear (in use), so a set bit
+	// always names a real block.
+	nwords = ROUNDUP(super->s_nblocks, 32) / 32;
+	for (i = 0; i <= nwords; i++) {
+		w = (goal / 32 + i) % nwords;
+		if (!bitmap[w])
+			continue;
+		if (i == 0 && (bitmap[w] >> (goal % 32)))
+			bno = w * 32 + goal % 32
+				+ __builtin_ctz(bitmap[w] >> (goal % 32));
+		else
+			bno = w * 32 + __builtin_ctz(bitmap[w]);
+
+		bitmap[w] &= ~(1 << (bno % 32));
+		dirty_note(bno / BLKBITSIZE + 2, 0);
+		alloc_hint = bno + 1;
+
+		// Drop any page the block's previous owner left
+		// mapped, so the caller maps a fresh one.
+		if (block_is_mapped(bno)
+		    && (r = sys_page_unmap(0, diskaddr(bno))) < 0)
+			panic("alloc_block_num: sys_page_unmap: %e", r);
+		return bno;
+	}
+
+	return -E_NO_DISK;
+}
+
+// Search the bitmap for a free block and allocate it, carrying on
+// from where the last search stopped.
 int
 alloc_block_num(void)
 {
-	uint32_t i;
+	return alloc_block_num_near(alloc_hint);
+}
 
-	// LAB 5: Your code here.
-	for (i = 3; i <= super->s_nblocks; i++) {
-		if (bitmap[i / 32] & (1 << (i % 32))) {
-			bitmap[i / 32] &= ~(1 << (i % 32));
-			write_block((i / BLKBITSIZE) + 2);
-			return i;
+// Find a run of 'n' free blocks at or after 'goal', wrapping around.
+// Returns the first block of the first such run, or of the longest
+// run there is if none is that long.  Allocates nothing.
+static uint32_t
+find_free_run(uint32_t goal, uint32_t n)
+{
+	uint32_t i, b, start, len, best, bestlen;
+
+	start = len = best = bestlen = 0;
+	for (i = 0; i < super->s_nblocks; i++) {
+		b = (goal + i) % super->s_nblocks;
+		if (!block_is_free(b)) {
+			len = 0;
+			continue;
+		}
+		if (len == 0 || b != start + len) {	// a run starts here
+			start = b;
+			len = 0;
+		}
+		len++;
+		if (len > bestlen) {
+			best = start;
+			bestlen = len;
 		}
+		if (len == n)
+			break;
 	}
-
-	return -E_NO_DISK;
+	return best;
 }
 
-// Allocate a block -- first find a free block in the bitmap,
-// then map it into memory.
+// Allocate a block at or after 'goal' and map it into memory: through
+// the buffer cache if 'cached' (it holds file data), for good otherwise.
 int
-alloc_block(void)
+alloc_block_near(uint32_t goal, bool cached)
 {
 	int r, bno;
 
-	if ((r = alloc_block_num()) < 0)
+	if ((r = alloc_block_num_near(goal)) < 0)
 		return r;
 	bno = r;
 
-	if ((r = map_block(bno)) < 0) {
+	r = cached ? bcache_map(bno) : map_block(bno);
+	if (r < 0) {
 		free_block(bno);
 		return r;
 	}
 	return bno;
 }
 
+// Allocate a block -- first find a free block in the bitmap,
+// then map it into memory.
+int
+alloc_block(void)
+{
+	return alloc_block_near(alloc_hint, 0);
+}
+
 // Read and validate the file system super-block.
 void
 read_super(void)
@@ -200,7 +262,7 @@ read_super(void)
 	int r;
 	char *blk;
 
-	if ((r = read_block(1, &blk)) < 0)
+	if ((r = read_block(1, &blk, 0)) < 0)
 		panic("cannot read superblock: %e", r);
 
 	super = (struct Super*) blk;
@@ -242,14 +304,14 @@ read_bitmap(void)
 	// LAB 5: Your code here.
 	assert(super);
 
-	r = read_block(2, &blk);
+	r = read_block(2, &blk, 0);
 	if (r)
 		panic("read_bitmap(): could not read first block: %e\n", r);
 
 	bitmap = (uint32_t *) blk;
 
-	for (i = 3; i <= (super->s_nblocks / BLKBITSIZE); i++) {
-		r = read_block(i, NULL);
+	for (i = 3; i < 2 + ROUNDUP(super->s_nblocks, BLKBITSIZE) / BLKBITSIZE; i++) {
+		r = read_block(i, NULL, 0);
 		if (r)
 			panic("read_bitmap(): read_block() failed: %e\n", r);
 	}
@@ -261,7 +323,7 @@ read_bitmap(void)
 
 	// Make sure that the bitmap blocks are marked in-use.
 	// LAB 5: Your code here.
-	for (i = 2; i <= (super->s_nblocks / BLKBITSIZE); i++)
+	for (i = 2; i < 2 + ROUNDUP(super->s_nblocks, BLKBITSIZE) / BLKBITSIZE; i++)
 		assert(!block_is_free(i));
 
 	cprintf("read_bitmap is good\n");
@@ -274,7 +336,7 @@ check_write_block(void)
 	super = 0;
 
 	// back up super block
-	read_block(0, 0);
+	read_block(0, 0, 0);
 	memcpy(diskaddr(0), diskaddr(1), PGSIZE);
 
 	// smash it 
@@ -288,7 +350,7 @@ check_write_block(void)
 	assert(!block_is_mapped(1));
 
 	// read it back in
-	read_block(1, 0);
+	read_block(1, 0, 0);
 	assert(strcmp(diskaddr(1), "OOPS!\n") == 0);
 
 	// fix it
@@ -306,6 +368,7 @@ fs_init(void)
 	static_assert(sizeof(struct File) == 256);
 
 	// Find a JOS disk.  Use the second IDE disk (number 1) if available.
+	ide_init();
 	if (ide_probe_disk1())
 		ide_set_disk(1);
 	else
@@ -316,11 +379,124 @@ fs_init(void)
 	read_bitmap();
 }
 
+// Note that we changed File 'f' itself, which lives in a block of its
+// directory (or in the superblock, for the root).
+static void
+file_note(struct File *f)
+{
+	dirty_note(((uintptr_t) f - DISKMAP) / BLKSIZE, f->f_dir);
+}
+
+// Note that we changed the slot for the 'filebno'th block of 'f'.
+static void
+file_note_slot(struct File *f, uint32_t filebno)
+{
+	uint32_t *dind;
+
+	if (filebno < NDIRECT)
+		file_note(f);
+	else if (filebno < NINDIRECT)
+		dirty_note(f->f_indirect, f);
+	else {
+		dind = (uint32_t *) diskaddr(f->f_dindirect);
+		dirty_note(dind[(filebno - NINDIRECT) / NINDIRECT], f);
+	}
+}
+
+// The largest file the disk's format allows.
+off_t
+fs_max_file_size(void)
+{
+	if (super->s_features & FS_FEAT_DINDIRECT)
+		return MAXBIGFILESIZE;
+	return MAXFILESIZE;
+}
+
+// Set '*blk' to the indirect block of 'f' whose number is in '*slot'.
+// The slot lives in block 'container', or in 'f' itself if that is 0.
+// If there is no block yet and 'alloc' is set, allocate a cleared one
+// just past the block before the 'filebno'th of 'f', ahead of the data
+// blocks it will point to.
+// Returns 0 on success, -E_NOT_FOUND if there is no block and 'alloc'
+// is 0, or another error from allocating or reading the block.
+static int
+file_indirect(struct File *f, uint32_t *slot, uint32_t container,
+	      uint32_t filebno, bool alloc, char **blk)
+{
+	int r;
+	bool fresh;
+
+	fresh = 0;
+	if (*slot == 0) {
+		if (alloc == 0)
+			return -E_NOT_FOUND;
+		if ((r = alloc_block_near(file_alloc_goal(f, filebno), 0)) < 0)
+			return r;
+		*slot = r;
+		if (container)
+			dirty_note(container, f);
+		else
+			file_note(f);
+		fresh = 1;
+	}
+	// Indirect blocks stay in memory once read, possibly with
+	// pointers that aren't on disk yet.
+	if (block_is_mapped(*slot))
+		*blk = diskaddr(*slot);
+	else if ((r = read_block(*slot, blk, 0)) < 0)
+		return r;
+	assert(*blk != 0);
+	if (fresh) {		// must clear any block we allocated
+		memset(*blk, 0, BLKSIZE);
+		dirty_note(*slot, f);
+	}
+	return 0;
+}
+
+// Find the disk block number slot for the 'filebno'th block in file
+// 'f', like file_block_walk, and return how many slots from there on
+// sit next to it in the same array (f_direct or one indirect block),
+// for the blocks that follow 'filebno'.
+static int
+file_walk_slots(struct File *f, uint32_t filebno, uint32_t **ppdiskbno,
+		bool alloc)
+{
+	int r;
+	uint32_t i;
+	char *blk;
+
+	if (filebno < NDIRECT) {
+		*ppdiskbno = &f->f_direct[filebno];
+		return NDIRECT - filebno;
+	}
+
+	if (filebno < NINDIRECT) {
+		if ((r = file_indirect(f, &f->f_indirect, 0, filebno, alloc,
+				       &blk)) < 0)
+			return r;
+		*ppdiskbno = (uint32_t *) blk + filebno;
+		return NINDIRECT - filebno;
+	}
+
+	if (filebno - NINDIRECT >= NDINDIRECT
+	    || !(super->s_features & FS_FEAT_DINDIRECT))
+		return -E_INVAL;
+	i = filebno - NINDIRECT;
+	if ((r = file_indirect(f, &f->f_dindirect, 0, filebno, alloc,
+			       &blk)) < 0
+	    || (r = file_indirect(f, (uint32_t *) blk + i / NINDIRECT,
+				  f->f_dindirect, filebno, alloc, &blk)) < 0)
+		return r;
+	*ppdiskbno = (uint32_t *) blk + i % NINDIRECT;
+	return NINDIRECT - i % NINDIRECT;
+}
+
 // Find the disk block number slot for the 'filebno'th block in file 'f'.
 // Set '*ppdiskbno' to point to that slot.
-// The slot will be one of the f->f_direct[] entries,
-// or an entry in the indirect block.
-// When 'alloc' is set, this function will allocate an indirect block
+// The slot will be one of the f->f_direct[] entries, an entry in the
+// indirect block, or, if the disk has FS_FEAT_DINDIRECT, an entry in
+// one of the indirect blocks the double-indirect block points to.
+// When 'alloc' is set, this function will allocate indirect blocks
 // if necessary.
 //
 // Returns:
@@ -329,37 +505,80 @@ fs_init(void)
 //		alloc was 0.
 //	-E_NO_DISK if there's no space on the disk for an indirect block.
 //	-E_NO_MEM if there's no space in memory for an indirect block.
-//	-E_INVAL if filebno is out of range (it's >= NINDIRECT).
+//	-E_INVAL if filebno is out of range for the disk's format.
 //
 // Analogy: This is like pgdir_walk for files.  
 int
 file_block_walk(struct File *f, uint32_t filebno, uint32_t **ppdiskbno, bool alloc)
 {
 	int r;
-	uint32_t *ptr;
-	char *blk;
 
-	if (filebno < NDIRECT)
-		ptr = &f->f_direct[filebno];
-	else if (filebno < NINDIRECT) {
-		if (f->f_indirect == 0) {
-			if (alloc == 0)
-				return -E_NOT_FOUND;
-			if ((r = alloc_block()) < 0)
+	if ((r = file_walk_slots(f, filebno, ppdiskbno, alloc)) < 0)
+		return r;
+	return 0;
+}
+
+// Find the run of blocks of 'f' from 'filebno' on that lie one after
+// another on disk, up to 'n' of them, looking at whole arrays of block
+// pointers at a time rather than walking to each block.
+// Sets '*diskbno' to the disk block of the first and returns how many
+// there are, or < 0 on error:
+//	-E_NOT_FOUND if block 'filebno' doesn't exist.
+//	-E_INVAL if filebno is out of range.
+int
+file_map_run(struct File *f, uint32_t filebno, uint32_t n, uint32_t *diskbno)
+{
+	int r;
+	uint32_t *ptr, i, len;
+
+	len = 0;
+	while (len < n) {
+		if ((r = file_walk_slots(f, filebno + len, &ptr, 0)) < 0) {
+			if (len == 0)
 				return r;
-			f->f_indirect = r;
-		} else
-			alloc = 0;	// we did not allocate a block
-		if ((r = read_block(f->f_indirect, &blk)) < 0)
-			return r;
-		assert(blk != 0);
-		if (alloc)		// must clear any block we allocated
-			memset(blk, 0, BLKSIZE);
-		ptr = (uint32_t*)blk + filebno;
-	} else
-		return -E_INVAL;
+			break;
+		}
+		if (len == 0) {
+			if (*ptr == 0)
+				return -E_NOT_FOUND;
+			*diskbno = *ptr;
+		}
+		for (i = 0; i < r && len < n && ptr[i] == *diskbno + len; i++)
+			len++;
+		if (i < r)
+			break;
+	}
+	return len;
+}
+
+// Where to look for a disk block to hold the 'filebno'th block of
+// 'f': just past the file's previous block, so that files stay
+// contiguous on disk and reads of them can be clustered.  A file's
+// first block goes just past its directory entry, so that files sit
+// near their directory's blocks, and directories near their parent's.
+static uint32_t
+file_alloc_goal(struct File *f, uint32_t filebno)
+{
+	uint32_t *ptr;
+
+	if (filebno > 0 && file_block_walk(f, filebno - 1, &ptr, 0) == 0
+	    && *ptr)
+		return *ptr + 1;
+	return ((uintptr_t) f - DISKMAP) / BLKSIZE + 1;
+}
+
+// Allocate a block at or after 'goal' as the 'filebno'th block of 'f',
+// whose slot is '*ptr'.  Returns 0 on success, < 0 on error.
+static int
+file_alloc_block(struct File *f, uint32_t filebno, uint32_t *ptr,
+		 uint32_t goal)
+{
+	int r;
 
-	*ppdiskbno = ptr;
+	if ((r = alloc_block_near(goal, f->f_type != FTYPE_DIR)) < 0)
+		return r;
+	*ptr = r;
+	file_note_slot(f, filebno);
 	return 0;
 }
 
@@ -383,9 +602,10 @@ file_map_block(struct File *f, uint32_t filebno, uint32_t *diskbno, bool alloc)
 	if (*ptr == 0) {
 		if (alloc == 0)
 			return -E_NOT_FOUND;
-		if ((r = alloc_block()) < 0)
+		r = file_alloc_block(f, filebno, ptr,
+				     file_alloc_goal(f, filebno));
+		if (r < 0)
 			return r;
-		*ptr = r;
 	}
 	*diskbno = *ptr;
 	return 0;
@@ -404,6 +624,7 @@ file_clear_block(struct File *f, uint32_t filebno)
 	if (*ptr) {
 		free_block(*ptr);
 		*ptr = 0;
+		file_note_slot(f, filebno);
 	}
 	return 0;
 }
@@ -429,13 +650,91 @@ file_get_block(struct File *f, uint32_t filebno, char **blk)
 	// XXX: I'm not sure whether this is the right
 	// thing to do, however, looks like lab5 says
 	// to do that (p. 7).
+	// The caller may write into the block.
+	dirty_note(diskbno, f);
+
 	if (block_is_mapped(diskbno)) {
+		if (f->f_type != FTYPE_DIR)
+			bcache_stats.st_hits++;
 		if (blk)
 			*blk = diskaddr(diskbno);
 		return 0;
 	}
 
-	return read_block(diskbno, blk);
+	// Directory blocks hold the File structs that open files and
+	// f_dir point at, so only regular file data may be evicted.
+	if (f->f_type == FTYPE_DIR)
+		return read_block(diskbno, blk, 0);
+	bcache_stats.st_misses++;
+	return read_block(diskbno, blk, 1);
+}
+
+// Read the run of 'n' disk blocks starting at 'start', which must not
+// be in memory, with as few disk commands as possible: each stretch of
+// them that is still mapped once all are in the cache is read into its
+// consecutive diskaddr pages by a single ide_read.
+static void
+read_run(uint32_t start, uint32_t n)
+{
+	uint32_t i, j, k;
+	char *addr;
+
+	for (i = 0; i < n; i++) {
+		if (bcache_map(start + i) < 0)
+			break;
+		// Touch it so that CLOCK passes over it for now.
+		*(volatile char *) diskaddr(start + i);
+	}
+	n = i;
+
+	for (i = 0; i < n; i = j + 1) {
+		for (j = i; j < n && block_is_mapped(start + j); j++)
+			/* do nothing */;
+		if (j == i)
+			continue;
+		addr = diskaddr(start + i);
+		if (ide_read((start + i) * BLKSECTS, addr, (j - i) * BLKSECTS) < 0) {
+			for (k = i; k < n; k++)
+				if (block_is_mapped(start + k))
+					sys_page_unmap(0, diskaddr(start + k));
+			return;
+		}
+		for (k = i; k < j; k++) {
+			addr = diskaddr(start + k);
+			sys_page_map(0, addr, 0, addr, vpt[VPN(addr)] & PTE_USER);
+		}
+	}
+}
+
+// Bring blocks 'filebno' through 'filebno + n - 1' of regular file 'f'
+// into the cache ahead of need, stopping at the end of the file or at a
+// hole.  Blocks that are next to each other on disk are read together,
+// up to FS_MAXRUN at a time.
+void
+file_prefetch(struct File *f, uint32_t filebno, uint32_t n)
+{
+	int r;
+	uint32_t i, j, k, end, diskbno;
+
+	if (f->f_type == FTYPE_DIR)
+		return;
+
+	end = MIN(filebno + n, (uint32_t) ROUNDUP(f->f_size, BLKSIZE) / BLKSIZE);
+	for (i = filebno; i < end; i += r) {
+		if ((r = file_map_run(f, i, end - i, &diskbno)) < 0)
+			break;
+		// Read the stretches of the run that aren't in memory yet.
+		for (j = 0; j < r; j = k) {
+			if (block_is_mapped(diskbno + j)) {
+				k = j + 1;
+				continue;
+			}
+			for (k = j; k < r && k - j < FS_MAXRUN
+				     && !block_is_mapped(diskbno + k); k++)
+				/* do nothing */;
+			read_run(diskbno + j, k - j);
+		}
+	}
 }
 
 // Mark the offset/BLKSIZE'th block dirty in file f
@@ -452,6 +751,16 @@ file_dirty(struct File *f, off_t offset)
 	return 0;
 }
 
+// Drop the hashed index of directory 'dir' (see dirindex.c), so that
+// it is searched linearly.
+static void
+dir_drop_index(struct File *dir)
+{
+	dirindex_free(dir->f_index);
+	dir->f_index = 0;
+	file_note(dir);
+}
+
 // Try to find a file named "name" in dir.  If so, set *file to it.
 int
 dir_lookup(struct File *dir, const char *name, struct File **file)
@@ -461,6 +770,13 @@ dir_lookup(struct File *dir, const char *name, struct File **file)
 	char *blk;
 	struct File *f;
 
+	// Big directories have an index to look the name up in.
+	if (dir->f_index) {
+		if ((r = dirindex_lookup(dir, name, file)) == 0)
+			(*file)->f_dir = dir;
+		return r;
+	}
+
 	// Search dir for name.
 	// We maintain the invariant that the size of a directory-file
 	// is always a multiple of the file system's block size.
@@ -480,34 +796,49 @@ dir_lookup(struct File *dir, const char *name, struct File **file)
 	return -E_NOT_FOUND;
 }
 
-// Set *file to point at a free File structure in dir.
+// Set *file to point at a free File structure in dir,
+// and *slot to its number (block * BLKFILES + index in block).
 int
-dir_alloc_file(struct File *dir, struct File **file)
+dir_alloc_file(struct File *dir, struct File **file, uint32_t *slot)
 {
 	int r;
-	uint32_t nblock, i, j;
+	uint32_t nblock, i, j, first, root;
 	char *blk;
 	struct File *f;
 
 	assert((dir->f_size % BLKSIZE) == 0);
 	nblock = dir->f_size / BLKSIZE;
-	for (i = 0; i < nblock; i++) {
+	// An index knows where the first free slot may be.
+	first = dir->f_index ? dirindex_free_slot(dir) : 0;
+	for (i = first / BLKFILES; i < nblock; i++) {
 		if ((r = file_get_block(dir, i, &blk)) < 0)
 			return r;
 		f = (struct File*) blk;
-		for (j = 0; j < BLKFILES; j++)
+		j = (i == first / BLKFILES) ? first % BLKFILES : 0;
+		for (; j < BLKFILES; j++)
 			if (f[j].f_name[0] == '\0') {
 				*file = &f[j];
+				*slot = i * BLKFILES + j;
 				f[j].f_dir = dir;
 				return 0;
 			}
 	}
 	dir->f_size += BLKSIZE;
+	file_note(dir);
 	if ((r = file_get_block(dir, i, &blk)) < 0)
 		return r;
 	f = (struct File*) blk;
 	*file = &f[0];
+	*slot = i * BLKFILES;
 	f[0].f_dir = dir;
+
+	// Index the directory once it gets too big to search linearly.
+	if (!dir->f_index && nblock + 1 > DIRINDEX_MIN
+	    && (super->s_features & FS_FEAT_DIRINDEX)
+	    && dirindex_build(dir, &root) == 0) {
+		dir->f_index = root;
+		file_note(dir);
+	}
 	return 0;
 }
 
@@ -583,15 +914,19 @@ file_create(const char *path, struct File **pf)
 {
 	char name[MAXNAMELEN];
 	int r;
+	uint32_t slot;
 	struct File *dir, *f;
 
 	if ((r = walk_path(path, &dir, &f, name)) == 0)
 		return -E_FILE_EXISTS;
 	if (r != -E_NOT_FOUND || dir == 0)
 		return r;
-	if (dir_alloc_file(dir, &f) < 0)
+	if (dir_alloc_file(dir, &f, &slot) < 0)
 		return r;
 	strcpy(f->f_name, name);
+	file_note(f);
+	if (dir->f_index && dirindex_add(dir, name, slot) < 0)
+		dir_drop_index(dir);
 	*pf = f;
 	return 0;
 }
@@ -614,98 +949,145 @@ file_open(const char *path, struct File **pf)
 // been allocated (f->f_indirect != 0), then free the indirect block too.
 // (Remember to clear the f->f_indirect pointer so you'll know
 // whether it's valid!)
+// Likewise free the indirect blocks under the double-indirect block
+// that no longer point to anything, and the double-indirect block
+// itself once new_nblocks is no more than NINDIRECT.
 // Do not change f->f_size.
 static void
 file_truncate_blocks(struct File *f, off_t newsize)
 {
 	int r;
+	uint32_t bno, old_nblocks, new_nblocks, i, *dind;
 	char *blk;
-	uint32_t bno, old_nblocks, new_nblocks;
 
 	// Hint: Use file_clear_block and/or free_block.
 	// LAB 5: Your code here.
 	assert(f->f_size > newsize);
 
+	// A directory's index would point past its new end.
+	if (f->f_index)
+		dir_drop_index(f);
+
 	old_nblocks = f->f_size / BLKSIZE;
 	if (f->f_size % BLKSIZE)
 		++old_nblocks;
 	new_nblocks = newsize / BLKSIZE;
 
+	// file_clear_block zeroes each block's slot.
 	for (bno = new_nblocks; bno < old_nblocks; bno++) {
 		r = file_clear_block(f, bno);
-		if (r)
+		if (r && r != -E_NOT_FOUND)
 			panic("file_clear_block(): %e\n", r);
-		if (bno < NDIRECT) {
-			f->f_direct[bno] = 0;
-		} else {
-			assert(f->f_indirect != 0);
-			if (!va_is_mapped(diskaddr(f->f_indirect))) {
-				r = read_block(f->f_indirect, &blk);
-				if (r)
-					panic("read_block(): %e\n", r);
+	}
+
+	if (f->f_dindirect) {
+		if ((r = file_indirect(f, &f->f_dindirect, 0, 0, 0, &blk)) < 0)
+			panic("file_indirect(): %e\n", r);
+		dind = (uint32_t *) blk;
+		for (i = 0; i < NINDIRECT; i++)
+			if (dind[i] && NINDIRECT + i * NINDIRECT >= new_nblocks) {
+				free_block(dind[i]);
+				dind[i] = 0;
+				dirty_note(f->f_dindirect, f);
 			}
-			*(blk + bno) = 0;
+		if (new_nblocks <= NINDIRECT) {
+			free_block(f->f_dindirect);
+			f->f_dindirect = 0;
+			file_note(f);
 		}
 	}
 
 	if (new_nblocks <= NDIRECT && f->f_indirect) {
 		free_block(f->f_indirect);
 		f->f_indirect = 0;
+		file_note(f);
 	}
 }
 
 int
 file_set_size(struct File *f, off_t newsize)
 {
+	if (newsize < 0 || newsize > fs_max_file_size())
+		return -E_NO_DISK;
 	if (f->f_size > newsize)
 		file_truncate_blocks(f, newsize);
 	f->f_size = newsize;
+	file_note(f);
 	if (f->f_dir)
 		file_flush(f->f_dir);
 	return 0;
 }
 
-// Flush the contents of file f out to disk.
-// Loop over all the blocks in file.
-// Translate the file block number into a disk block number
-// and then check whether that disk block is dirty.  If so, write it out.
+// Give 'f' disk blocks for the 'len' bytes from 'offset' on, as one
+// contiguous run if the disk has one that long, and grow the file to
+// cover them.  Blocks 'f' already has are kept.  The new blocks read
+// as zeros, and are written out as such.
 //
-// Hint: use file_map_block, block_is_dirty, and write_block.
-void
-file_flush(struct File *f)
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if the range is empty or goes past fs_max_file_size().
+//	-E_NO_DISK if the disk fills up; the blocks allocated so far stay.
+//	-E_NO_MEM if we're out of memory.
+int
+file_allocate(struct File *f, off_t offset, off_t len)
 {
 	int r;
-	uint32_t diskbno, i;
+	uint32_t i, first, end, goal, *ptr;
+	off_t newsize;
 
-	// LAB 5: Your code here.
-	for (i = 0; i < NINDIRECT; i++) {
-		r = file_map_block(f, i, &diskbno, 0);
-		if (r == -E_NOT_FOUND || r == -E_INVAL)
-			break;
-		if (r < 0)
-			continue;
-		if (block_is_dirty(diskbno))
-			write_block(diskbno);
+	if (offset < 0 || len <= 0 || len > fs_max_file_size() - offset)
+		return -E_INVAL;
+
+	first = offset / BLKSIZE;
+	end = ROUNDUP(offset + len, BLKSIZE) / BLKSIZE;
+	goal = find_free_run(file_alloc_goal(f, first), end - first);
+	for (i = first; i < end; i++) {
+		if ((r = file_block_walk(f, i, &ptr, 1)) < 0)
+			goto out;
+		if (!*ptr) {
+			if ((r = file_alloc_block(f, i, ptr, goal)) < 0)
+				goto out;
+			// Dirty the zeroed page, so that write-back
+			// clears whatever the disk held there.
+			*(volatile char *) diskaddr(*ptr) = 0;
+			dirty_note(*ptr, f);
+		}
+		goal = *ptr + 1;
+	}
+	r = 0;
+
+out:
+	// Cover whatever was allocated, so that truncation frees it.
+	newsize = (r == 0) ? offset + len : (off_t) (i * BLKSIZE);
+	if (f->f_size < newsize) {
+		f->f_size = newsize;
+		file_note(f);
 	}
+	return r;
 }
 
-// Sync the entire file system.  A big hammer.
+// Flush the contents of file f out to disk: write the blocks of f
+// that have been noted as possibly dirty (see dirty.c) and are.
+// This includes f's indirect block, but not its entry in its
+// directory; flush f->f_dir for that.
+void
+file_flush(struct File *f)
+{
+	dirty_flush(f);
+}
+
+// Sync the entire file system.  A big hammer, but it only has to look
+// at the blocks noted as possibly dirty.
 void
 fs_sync(void)
 {
-	int i;
-	for (i = 0; i < super->s_nblocks; i++)
-		if (block_is_dirty(i))
-			write_block(i);
+	dirty_flush_all();
 }
 
-// Close a file.
+// Close a file.  Its dirty blocks, and its directory's, are left for
+// the periodic write-back (see dirty.c) or fs_sync to write out.
 void
 file_close(struct File *f)
 {
-	file_flush(f);
-	if (f->f_dir)
-		file_flush(f->f_dir);
 }
 
 // Remove a file by truncating it and then zeroing the name.
@@ -713,14 +1095,18 @@ int
 file_remove(const char *path)
 {
 	int r;
-	struct File *f;
+	struct File *dir, *f;
 
-	if ((r = walk_path(path, 0, &f, 0)) < 0)
+	if ((r = walk_path(path, &dir, &f, 0)) < 0)
 		return r;
 
-	file_truncate_blocks(f, 0);
+	if (dir && dir->f_index && dirindex_remove(dir, f) < 0)
+		dir_drop_index(dir);
+	if (f->f_size > 0)
+		file_truncate_blocks(f, 0);
 	f->f_name[0] = '\0';
 	f->f_size = 0;
+	file_note(f);
 	if (f->f_dir)
 		file_flush(f->f_dir);
 
@@ -11,27 +11,79 @@
 /* Maximum disk size we can handle (3GB) */
 #define DISKSIZE	0xC0000000
 
+/* Number of file data blocks the buffer cache keeps mapped at once. */
+#ifndef BCACHE_NBLOCKS
+#define BCACHE_NBLOCKS	256
+#endif
+
+/* Most blocks read by one disk command: ide_read's 256-sector limit. */
+#define FS_MAXRUN	(256 / BLKSECTS)
+
+/* PTE_AVAIL bit marking the pages of blocks in the buffer cache. */
+#define PTE_CACHED	0x800
+
 /* ide.c */
+void	ide_init(void);
 bool	ide_probe_disk1(void);
 void	ide_set_disk(int diskno);
 int	ide_read(uint32_t secno, void *dst, size_t nsecs);
 int	ide_write(uint32_t secno, const void *src, size_t nsecs);
 
+/* bcache.c */
+extern struct Fsstats bcache_stats;
+int	bcache_map(uint32_t blockno);
+
+/* ioq.c */
+void	ioq_write(uint32_t blockno);
+void	ioq_flush(void);
+
+/* dirty.c */
+void	dirty_note(uint32_t blockno, struct File *owner);
+void	dirty_forget(uint32_t blockno);
+void	dirty_flush(struct File *f);
+void	dirty_flush_all(void);
+void	dirty_writeback(void);
+
+/* dirindex.c */
+int	dirindex_build(struct File *dir, uint32_t *root);
+void	dirindex_free(uint32_t root);
+int	dirindex_lookup(struct File *dir, const char *name, struct File **file);
+int	dirindex_add(struct File *dir, const char *name, uint32_t slot);
+int	dirindex_remove(struct File *dir, struct File *f);
+uint32_t dirindex_free_slot(struct File *dir);
+
 /* fs.c */
+char*	diskaddr(uint32_t blockno);
+bool	va_is_mapped(void *va);
+bool	va_is_dirty(void *va);
+bool	block_is_mapped(uint32_t blockno);
+bool	block_is_dirty(uint32_t blockno);
+bool	block_is_free(uint32_t blockno);
+int	read_block(uint32_t blockno, char **blk, bool cached);
+void	write_block(uint32_t blockno);
+void	unmap_block(uint32_t blockno);
 int	file_create(const char *path, struct File **f);
 int	file_open(const char *path, struct File **f);
 int	file_get_block(struct File *f, uint32_t file_blockno, char **pblk);
+int	file_map_run(struct File *f, uint32_t file_blockno, uint32_t n,
+		     uint32_t *diskbno);
+void	file_prefetch(struct File *f, uint32_t file_blockno, uint32_t n);
 int	file_set_size(struct File *f, off_t newsize);
+int	file_allocate(struct File *f, off_t offset, off_t len);
 void	file_flush(struct File *f);
 void	file_close(struct File *f);
 int	file_remove(const char *path);
 void	fs_init(void);
+off_t	fs_max_file_size(void);
 int	file_dirty(struct File *f, off_t offset);
 void	fs_sync(void);
 
+extern struct Super *super;
 extern uint32_t *bitmap;
 int	map_block(uint32_t);
+int	alloc_block_near(uint32_t goal, bool cached);
 int	alloc_block(void);
+void	free_block(uint32_t blockno);
 
 /* test.c */
 void	fs_test(void);
@@ -37,6 +37,9 @@ typedef int bool;
 #define USED
 #endif
 
+// Most blocks the file system server can map (DISKSIZE in fs/fs.h)
+#define MAXBLOCKS	(0xC0000000 / BLKSIZE)
+
 #define nelem(x)	(sizeof(x) / sizeof((x)[0]))
 typedef struct Super Super;
 typedef struct File File;
@@ -112,6 +115,8 @@ swizzlefile(struct File *f)
 	for (i = 0; i < NDIRECT; i++)
 		swizzle(&f->f_direct[i]);
 	swizzle(&f->f_indirect);
+	swizzle(&f->f_dindirect);
+	swizzle(&f->f_index);
 }
 
 void
@@ -128,6 +133,7 @@ swizzleblock(struct Block *b)
 		swizzle(&s->s_magic);
 		swizzle(&s->s_nblocks);
 		swizzlefile(&s->s_root);
+		swizzle(&s->s_features);
 		break;
 	case BLOCK_DIR:
 		f = (struct File*) b->buf;
@@ -251,6 +257,7 @@ opendisk(const char *name)
 
 	super.s_magic = FS_MAGIC;
 	super.s_nblocks = nblocks;
+	super.s_features = FS_FEAT_DINDIRECT | FS_FEAT_DIRINDEX;
 	super.s_root.f_type = FTYPE_DIR;
 	strcpy(super.s_root.f_name, "/");
 }
@@ -269,12 +276,46 @@ storeblk(struct File *f, struct Block *b, int nblk)
 			bindir = getblk(f->f_indirect, 0, BLOCK_BITS);
 		((uint32_t*)bindir->buf)[nblk] = b->bno;
 		putblk(bindir);
+	} else if (nblk < MAXBIGFILESIZE / BLKSIZE) {
+		struct Block *bdind, *bindir;
+		uint32_t *slot;
+		nblk -= NINDIRECT;
+		if (f->f_dindirect == 0) {
+			bdind = getblk(nextb++, 1, BLOCK_BITS);
+			f->f_dindirect = bdind->bno;
+		} else
+			bdind = getblk(f->f_dindirect, 0, BLOCK_BITS);
+		slot = &((uint32_t*)bdind->buf)[nblk / NINDIRECT];
+		if (*slot == 0) {
+			bindir = getblk(nextb++, 1, BLOCK_BITS);
+			*slot = bindir->bno;
+		} else
+			bindir = getblk(*slot, 0, BLOCK_BITS);
+		((uint32_t*)bindir->buf)[nblk % NINDIRECT] = b->bno;
+		putblk(bindir);
+		putblk(bdind);
 	} else {
 		fprintf(stderr, "file too large\n");
 		abort();
 	}
 }
 
+// Return the disk block holding block 'nblk' of directory 'dirf'.
+uint32_t
+dirblock(struct File *dirf, int nblk)
+{
+	uint32_t bno;
+	struct Block *idirb;
+
+	if (nblk < NDIRECT)
+		return dirf->f_direct[nblk];
+	assert(nblk < NINDIRECT);
+	idirb = getblk(dirf->f_indirect, 0, BLOCK_BITS);
+	bno = ((uint32_t*)idirb->buf)[nblk];
+	putblk(idirb);
+	return bno;
+}
+
 struct File *
 allocfile(struct File *dirf, const char *name, struct Block **dirb)
 {
@@ -282,12 +323,8 @@ allocfile(struct File *dirf, const char *name, struct Block **dirb)
 	int nblk, i;
 
 	nblk = (int)((dirf->f_size + BLKSIZE - 1) / BLKSIZE) - 1;
-	if (nblk >= NDIRECT) {
-		struct Block *idirb = getblk(dirf->f_indirect, 0, BLOCK_BITS);
-		*dirb = getblk(((uint32_t*)idirb->buf) [nblk], 0, BLOCK_DIR);
-		putblk(idirb);
-	} else if (nblk >= 0)
-		*dirb = getblk(dirf->f_direct[nblk], 0, BLOCK_DIR);
+	if (nblk >= 0)
+		*dirb = getblk(dirblock(dirf, nblk), 0, BLOCK_DIR);
 	else
 		goto new_dirb;
 
@@ -360,6 +397,80 @@ writefile(struct File *dirf, const char *name)
 	putblk(dirb);
 }
 
+// Give directory 'dirf' a hashed index (see fs/dirindex.c) if it has
+// more than DIRINDEX_MIN blocks.  All its entries are known, so pick
+// the smallest table whose buckets hold them, with every bucket as deep
+// as the table.  If there is none, leave the directory unindexed.
+void
+indexdirectory(struct File *dirf)
+{
+	int nblk, i, j, n, nslot;
+	uint32_t depth, k, freeslot, *hash, *slot;
+	uint32_t count[1 << DIRINDEX_MAXDEPTH];
+	struct Block *b, *rootb;
+	struct File *ino;
+	struct Dirindex *di;
+	struct Dirbucket *db;
+
+	nblk = dirf->f_size / BLKSIZE;
+	if (nblk <= DIRINDEX_MIN)
+		return;
+	nslot = nblk * BLKFILES;
+	hash = malloc(nslot * sizeof(uint32_t));
+	slot = malloc(nslot * sizeof(uint32_t));
+	assert(hash && slot);
+
+	freeslot = nslot;
+	n = 0;
+	for (i = 0; i < nblk; i++) {
+		b = getblk(dirblock(dirf, i), 0, BLOCK_DIR);
+		ino = (struct File*) b->buf;
+		for (j = 0; j < BLKFILES; j++)
+			if (ino[j].f_name[0] == '\0') {
+				if (freeslot > i * BLKFILES + j)
+					freeslot = i * BLKFILES + j;
+			} else {
+				hash[n] = dir_hash(ino[j].f_name);
+				slot[n++] = i * BLKFILES + j;
+			}
+		putblk(b);
+	}
+
+	for (depth = 0; depth <= DIRINDEX_MAXDEPTH; depth++) {
+		memset(count, 0, sizeof(count));
+		for (i = 0; i < n; i++)
+			if (++count[hash[i] & DIRINDEX_MASK(depth)] > DIRBUCKET_NENTS)
+				break;
+		if (i == n)
+			break;
+	}
+	if (depth > DIRINDEX_MAXDEPTH)
+		goto out;
+
+	rootb = getblk(nextb++, 1, BLOCK_BITS);
+	di = (struct Dirindex*) rootb->buf;
+	di->di_depth = depth;
+	di->di_free = freeslot;
+	for (k = 0; k < (1 << depth); k++) {
+		b = getblk(nextb++, 1, BLOCK_BITS);
+		db = (struct Dirbucket*) b->buf;
+		db->db_depth = depth;
+		for (i = 0; i < n; i++)
+			if ((hash[i] & DIRINDEX_MASK(depth)) == k) {
+				db->db_ents[db->db_count].de_hash = hash[i];
+				db->db_ents[db->db_count].de_slot = slot[i];
+				db->db_count++;
+			}
+		di->di_buckets[k] = b->bno;
+		putblk(b);
+	}
+	dirf->f_index = rootb->bno;
+	putblk(rootb);
+out:
+	free(hash);
+	free(slot);
+}
+
 void
 writedirectory(struct File *parentdirf, char *name, int root)
 {
@@ -415,6 +526,7 @@ writedirectory(struct File *parentdirf, char *name, int root)
 	}
 
 	closedir(dir);
+	indexdirectory(dirf);
 	if (dirb)
 		putblk(dirb);
 }
@@ -474,7 +586,7 @@ main(int argc, char **argv)
 		usage();
 
 	nblocks = strtol(argv[2], &s, 0);
-	if (*s || s == argv[2] || nblocks < 2 || nblocks > 1024)
+	if (*s || s == argv[2] || nblocks < 2 || nblocks > MAXBLOCKS)
 		usage();
 	
 	opendisk(argv[1]);
@@ -486,6 +598,7 @@ main(int argc, char **argv)
 	} else {
 		for (i = 3; i < argc; i++)
 			writefile(&super.s_root, argv[i]);
+		indexdirectory(&super.s_root);
 	}
 	
 	finishfs();
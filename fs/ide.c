@@ -1,5 +1,10 @@
 /*
- * Minimal PIO-based (non-interrupt-driven) IDE driver code.
+ * Minimal IDE driver code.  If the PCI bus has a bus-master IDE
+ * controller (a PIIX, say, as QEMU and Bochs emulate), the drive
+ * moves the data to and from memory itself by DMA; otherwise we move
+ * it with PIO.  While the drive works on a command we sleep until it
+ * interrupts on IRQ 14 (see sys_irq_wait), falling back to polling if
+ * the kernel won't let us have the IRQ.
  * For information about what all this IDE/ATA magic means,
  * see the materials available on the class references page.
  */
@@ -12,15 +17,113 @@
 #define IDE_DF		0x20
 #define IDE_ERR		0x01
 
+#define IDE_IRQ		14
+
+// PCI configuration space access ports
+#define PCI_CONF_ADDR	0xCF8
+#define PCI_CONF_DATA	0xCFC
+
+// Bus-master IDE registers of the primary channel, at offsets from
+// the base port in the controller's BAR4
+#define BM_CMD		0
+#define BM_CMD_START	0x01
+#define BM_CMD_READ	0x08	// transfer from the drive to memory
+#define BM_STATUS	2
+#define BM_ST_ERR	0x02
+#define BM_ST_INTR	0x04	// the drive has interrupted
+#define BM_PRDT		4	// physical address of the PRD table
+
+// A physical region descriptor: one piece of a DMA transfer's buffer.
+// A piece mustn't cross a 64KB boundary, which pieces of one page never do.
+struct Prd {
+	uint32_t prd_addr;	// physical address
+	uint16_t prd_len;	// byte count
+	uint16_t prd_flags;
+};
+#define PRD_EOT		0x8000	// last entry in the table
+
+// Page holding the PRD table; a page is physically contiguous
+#define PRDTVA		0xE0000000
+
 static int diskno = 1;
+static bool ide_irq;		// true if we get IRQ 14
+static uint16_t bm_base;	// bus-master registers, 0 if no DMA
+static struct Prd *prdt = (struct Prd *) PRDTVA;
+static uint32_t prdt_pa;	// physical address of prdt
+
+static uint32_t
+pci_conf_read(int dev, int func, int off)
+{
+	outl(PCI_CONF_ADDR, 0x80000000 | (dev << 11) | (func << 8) | off);
+	return inl(PCI_CONF_DATA);
+}
+
+static void
+pci_conf_write(int dev, int func, int off, uint32_t v)
+{
+	outl(PCI_CONF_ADDR, 0x80000000 | (dev << 11) | (func << 8) | off);
+	outl(PCI_CONF_DATA, v);
+}
+
+// Look on PCI bus 0 for an IDE controller that can do bus-master DMA,
+// and get ready to use it.  Leaves bm_base 0 if there is none.
+static void
+ide_dma_init(void)
+{
+	int dev, func, r;
+	uint32_t class, bar4;
+
+	for (dev = 0; dev < 32; dev++)
+		for (func = 0; func < 8; func++) {
+			if ((pci_conf_read(dev, func, 0) & 0xFFFF) == 0xFFFF)
+				continue;
+			// Mass storage, IDE, with bus mastering (prog-if bit 7)
+			class = pci_conf_read(dev, func, 8) >> 8;
+			if ((class & 0xFFFF80) != 0x010180)
+				continue;
+			bar4 = pci_conf_read(dev, func, 0x20);
+			if (!(bar4 & 1))
+				continue;
+
+			if ((r = sys_page_alloc(0, prdt, PTE_P|PTE_U|PTE_W)) < 0
+			    || (r = sys_page_phys(prdt)) < 0) {
+				cprintf("ide: no DMA, no PRD table: %e\n", r);
+				return;
+			}
+			prdt_pa = r;
+
+			// Enable I/O space and bus mastering
+			pci_conf_write(dev, func, 4,
+				       pci_conf_read(dev, func, 4) | 0x5);
+			bm_base = bar4 & 0xFFFC;
+			cprintf("ide: bus-master DMA at port %x\n", bm_base);
+			return;
+		}
+}
+
+void
+ide_init(void)
+{
+	int r;
+
+	if ((r = sys_irq_register(IDE_IRQ)) < 0)
+		cprintf("ide: polling, no IRQ %d: %e\n", IDE_IRQ, r);
+	else
+		ide_irq = 1;
+	ide_dma_init();
+}
 
 static int
 ide_wait_ready(bool check_error)
 {
 	int r;
 
+	// Reading the status register also clears the drive's interrupt,
+	// so an interrupt that arrives while we look just makes
+	// sys_irq_wait return at once and we look again.
 	while (((r = inb(0x1F7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
-		/* do nothing */;
+		if (ide_irq)
+			sys_irq_wait();
 
 	if (check_error && (r & (IDE_DF|IDE_ERR)) != 0)
 		return -1;
@@ -57,11 +160,10 @@ ide_set_disk(int d)
 	diskno = d;
 }
 
-int
-ide_read(uint32_t secno, void *dst, size_t nsecs)
+// Tell the drive to start command 'cmd' on 'nsecs' sectors from 'secno'.
+static void
+ide_start(uint32_t secno, size_t nsecs, int cmd)
 {
-	int r;
-
 	assert(nsecs <= 256);
 
 	ide_wait_ready(0);
@@ -71,7 +173,67 @@ ide_read(uint32_t secno, void *dst, size_t nsecs)
 	outb(0x1F4, (secno >> 8) & 0xFF);
 	outb(0x1F5, (secno >> 16) & 0xFF);
 	outb(0x1F6, 0xE0 | ((diskno&1)<<4) | ((secno>>24)&0x0F));
-	outb(0x1F7, 0x20);	// CMD 0x20 means read sector
+	outb(0x1F7, cmd);
+}
+
+// Transfer 'nsecs' sectors from 'secno' between the drive and the
+// buffer at 'va' by DMA, reading from the drive unless 'write' is set.
+static int
+ide_dma(uint32_t secno, void *va, size_t nsecs, bool write)
+{
+	uintptr_t a, end;
+	size_t n;
+	int i, r, st, dir;
+
+	// One PRD per page, or piece of a page, of the buffer
+	a = (uintptr_t) va;
+	end = a + nsecs * SECTSIZE;
+	for (i = 0; a < end; i++, a += n) {
+		n = MIN(end - a, PGSIZE - PGOFF(a));
+		if ((r = sys_page_phys((void *) ROUNDDOWN(a, PGSIZE))) < 0)
+			return r;
+		prdt[i].prd_addr = r + PGOFF(a);
+		prdt[i].prd_len = n;
+		prdt[i].prd_flags = 0;
+	}
+	prdt[i - 1].prd_flags = PRD_EOT;
+
+	dir = write ? 0 : BM_CMD_READ;
+	outl(bm_base + BM_PRDT, prdt_pa);
+	outb(bm_base + BM_CMD, dir);
+	outb(bm_base + BM_STATUS, BM_ST_ERR | BM_ST_INTR);	// clear them
+	ide_start(secno, nsecs, write ? 0xCA : 0xC8);	// WRITE/READ DMA
+	outb(bm_base + BM_CMD, dir | BM_CMD_START);
+
+	while (!((st = inb(bm_base + BM_STATUS)) & BM_ST_INTR))
+		if (ide_irq)
+			sys_irq_wait();
+
+	outb(bm_base + BM_CMD, 0);
+	outb(bm_base + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+	r = inb(0x1F7);		// also acknowledges the drive's interrupt
+	if ((st & BM_ST_ERR) || (r & (IDE_DF|IDE_ERR)))
+		return -1;
+	return 0;
+}
+
+// Can the buffer at 'va' go to the controller by DMA?
+// The PRD entries need even addresses.
+static bool
+ide_can_dma(const void *va, size_t nsecs)
+{
+	return bm_base && nsecs > 0 && ((uintptr_t) va & 1) == 0;
+}
+
+int
+ide_read(uint32_t secno, void *dst, size_t nsecs)
+{
+	int r;
+
+	if (ide_can_dma(dst, nsecs))
+		return ide_dma(secno, dst, nsecs, 0);
+
+	ide_start(secno, nsecs, 0x20);	// CMD 0x20 means read sector
 
 	for (; nsecs > 0; nsecs--, dst += SECTSIZE) {
 		if ((r = ide_wait_ready(1)) < 0)
@@ -86,17 +248,11 @@ int
 ide_write(uint32_t secno, const void *src, size_t nsecs)
 {
 	int r;
-	
-	assert(nsecs <= 256);
 
-	ide_wait_ready(0);
+	if (ide_can_dma(src, nsecs))
+		return ide_dma(secno, (void *) src, nsecs, 1);
 
-	outb(0x1F2, nsecs);
-	outb(0x1F3, secno & 0xFF);
-	outb(0x1F4, (secno >> 8) & 0xFF);
-	outb(0x1F5, (secno >> 16) & 0xFF);
-	outb(0x1F6, 0xE0 | ((diskno&1)<<4) | ((secno>>24)&0x0F));
-	outb(0x1F7, 0x30);	// CMD 0x30 means write sector
+	ide_start(secno, nsecs, 0x30);	// CMD 0x30 means write sector
 
 	for (; nsecs > 0; nsecs--, src += SECTSIZE) {
 		if ((r = ide_wait_ready(1)) < 0)
@@ -106,4 +262,3 @@ ide_write(uint32_t secno, const void *src, size_t nsecs)
 
 	return 0;
 }
-
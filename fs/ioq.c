@@ -0,0 +1,90 @@
+// Queue of pending block writes.
+//
+// Callers with several blocks to write queue them with ioq_write and
+// then call ioq_flush, which issues them in C-SCAN elevator order: up
+// the disk from where the last write stopped, then around again from
+// the lowest block.  Blocks next to each other on disk go out together
+// in one command of up to FS_MAXRUN blocks, from their consecutive
+// diskaddr pages.  Queued blocks must stay mapped until the flush.
+
+#include "fs.h"
+
+#define IOQ_MAX		256
+
+static uint32_t ioq[IOQ_MAX];	// queued block numbers
+static uint32_t ioq_n;		// number of blocks queued
+static uint32_t ioq_head;	// block after the last one written
+
+// Position of 'blockno' in elevator order: its distance up the disk
+// from the head, wrapping around past the end.
+static uint32_t
+ioq_key(uint32_t blockno)
+{
+	return blockno - ioq_head;
+}
+
+// Write the 'n' blocks from 'start' on out in one command and clear
+// their PTE_D bits.
+static void
+ioq_issue(uint32_t start, uint32_t n)
+{
+	int r;
+	uint32_t i;
+	char *addr;
+
+	addr = diskaddr(start);
+	if ((r = ide_write(start * BLKSECTS, addr, n * BLKSECTS)) < 0)
+		panic("ioq_issue: ide_write blocks %08x+%d: %e", start, n, r);
+
+	for (i = 0; i < n; i++, addr += BLKSIZE)
+		if ((r = sys_page_map(0, addr, 0, addr,
+				      vpt[VPN(addr)] & PTE_USER)) < 0)
+			panic("ioq_issue: sys_page_map: %e", r);
+	ioq_head = start + n;
+}
+
+// Queue block 'blockno' to be written at the next ioq_flush.
+void
+ioq_write(uint32_t blockno)
+{
+	if (!block_is_mapped(blockno))
+		panic("ioq_write: unmapped block %08x", blockno);
+	if (ioq_n == IOQ_MAX)
+		ioq_flush();
+	ioq[ioq_n++] = blockno;
+}
+
+// Write out every queued block.
+void
+ioq_flush(void)
+{
+	uint32_t i, j, b, start, len;
+
+	// Insertion sort into elevator order; the queue is short and
+	// usually queued nearly in order already.
+	for (i = 1; i < ioq_n; i++) {
+		b = ioq[i];
+		for (j = i; j > 0 && ioq_key(ioq[j - 1]) > ioq_key(b); j--)
+			ioq[j] = ioq[j - 1];
+		ioq[j] = b;
+	}
+
+	// Issue runs of adjacent blocks, skipping duplicates.
+	start = len = 0;
+	for (i = 0; i < ioq_n; i++) {
+		b = ioq[i];
+		if (len && b == start + len - 1)
+			continue;
+		if (len && b == start + len && len < FS_MAXRUN) {
+			len++;
+			continue;
+		}
+		if (len)
+			ioq_issue(start, len);
+		start = b;
+		len = 1;
+	}
+	if (len)
+		ioq_issue(start, len);
+	ioq_n = 0;
+}
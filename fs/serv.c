@@ -16,8 +16,19 @@ struct OpenFile {
 	struct File *o_file;	// mapped descriptor for open file
 	int o_mode;		// open mode
 	struct Fd *o_fd;	// Fd page
+	uint32_t o_next;	// block after the last one mapped
+	uint32_t o_ra;		// read-ahead window, in blocks
 };
 
+// Read-ahead window for a file being read sequentially: it starts at
+// RA_MIN blocks and doubles with each request that carries on where
+// the last one stopped, up to one disk command's worth.
+#define RA_MIN		4
+#define RA_MAX		FS_MAXRUN
+
+// Clock ticks between periodic write-backs
+#define FLUSH_INTERVAL	100
+
 // Max number of open files in the file system at once
 #define MAXOPEN		1024
 #define FILEVA		0xD0000000
@@ -30,6 +41,11 @@ struct OpenFile opentab[MAXOPEN] = {
 // Virtual address at which to receive page mappings containing client requests.
 #define REQVA		0x0ffff000
 
+// Window just below REQVA in which serve_map lines up the blocks it
+// sends, so that a whole file of up to MAXFILESIZE bytes (as much as a
+// client maps at once) can go out in one message.
+#define MAPVA		(REQVA - MAXFILESIZE)
+
 void
 serve_init(void)
 {
@@ -57,6 +73,8 @@ openfile_alloc(struct OpenFile **o)
 			/* fall through */
 		case 1:
 			opentab[i].o_fileid += MAXOPEN;
+			opentab[i].o_next = 0;
+			opentab[i].o_ra = 0;
 			*o = &opentab[i];
 			memset(opentab[i].o_fd, 0, PGSIZE);
 			return (*o)->o_fileid;
@@ -78,11 +96,13 @@ openfile_lookup(envid_t envid, uint32_t fileid, struct OpenFile **po)
 	return 0;
 }
 
-// Serve requests, sending responses back to envid.
-// To send a result back, ipc_send(envid, r, 0, 0).
-// To include a page, ipc_send(envid, r, srcva, perm).
-void
-serve_open(envid_t envid, struct Fsreq_open *rq)
+// Serve requests, returning the result to send back to envid.
+// To include a page in the reply, store it and its permissions
+// in *pg_store and *perm_store.
+// serve() sends the reply with ipc_reply_wait.
+int
+serve_open(envid_t envid, struct Fsreq_open *rq, void **pg_store,
+	   int *perm_store)
 {
 	char path[MAXPATHLEN];
 	struct File *f;
@@ -138,13 +158,14 @@ serve_open(envid_t envid, struct Fsreq_open *rq)
 
 	if (debug)
 		cprintf("sending success, page %08x\n", (uintptr_t) o->o_fd);
-	ipc_send(envid, 0, o->o_fd, PTE_P|PTE_U|PTE_W|PTE_SHARE);
-	return;
+	*pg_store = o->o_fd;
+	*perm_store = PTE_P|PTE_U|PTE_W|PTE_SHARE;
+	return 0;
 out:
-	ipc_send(envid, r, 0, 0);
+	return r;
 }
 
-void
+int
 serve_set_size(envid_t envid, struct Fsreq_set_size *rq)
 {
 	struct OpenFile *o;
@@ -184,7 +205,7 @@ serve_set_size(envid_t envid, struct Fsreq_set_size *rq)
 	// Here's how it goes.
 
 	// First, use openfile_lookup to find the relevant open file.
-	// On failure, return the error code to the client with ipc_send.
+	// On failure, return the error code to the client.
 	if ((r = openfile_lookup(envid, rq->req_fileid, &o)) < 0)
 		goto out;
 
@@ -200,44 +221,79 @@ serve_set_size(envid_t envid, struct Fsreq_set_size *rq)
 	// Finally, return to the client!
 	// (We just return r since we know it's 0 at this point.)
 out:
-	ipc_send(envid, r, 0, 0);
+	return r;
 }
 
-void
-serve_map(envid_t envid, struct Fsreq_map *rq)
+int
+serve_map(envid_t envid, struct Fsreq_map *rq, void **pg_store,
+	  unsigned *npages_store, int *perm_store)
 {
 	int r;
 	char *blk;
 	struct OpenFile *o;
-	int perm;
+	int perm, i, n;
+	uint32_t first, ra;
 
 	if (debug)
-		cprintf("serve_map %08x %08x %08x\n", envid, rq->req_fileid, rq->req_offset);
+		cprintf("serve_map %08x %08x %08x %d\n", envid, rq->req_fileid, rq->req_offset, rq->req_npages);
 
-	// Map the requested block in the client's address space
-	// by using ipc_send.
+	// Map the requested blocks in the client's address space
+	// by lining them up at MAPVA and returning that in *pg_store.
 	// Map read-only unless the file's open mode (o->o_mode) allows writes
 	// (see the O_ flags in inc/lib.h).
+	// Returns the number of blocks mapped, which is less than asked
+	// for if a later block can't be had.
 	
 	// LAB 5: Your code here.
 	if ((r = openfile_lookup(envid, rq->req_fileid, &o)) < 0)
 		goto out_err;
 
-	if ((r = file_get_block(o->o_file, rq->req_offset/BLKSIZE, &blk)) < 0)
-		goto out_err;
+	n = rq->req_npages;
+	if (rq->req_offset < 0 || rq->req_offset >= fs_max_file_size() || n <= 0)
+		return -E_INVAL;
+	n = MIN(n, MAXFILESIZE / BLKSIZE);
+	n = MIN(n, (fs_max_file_size() - rq->req_offset) / BLKSIZE);
 
 	perm = PTE_P | PTE_U | PTE_SHARE;
 	if (o->o_mode & (O_WRONLY|O_RDWR|O_ACCMODE))
 		perm |= PTE_W;
 
-	ipc_send(envid, 0, blk, perm);
-	return;
+	// A request that carries on where the last one stopped means the
+	// file is being read sequentially: widen the read-ahead window.
+	// Anything else closes it.
+	first = rq->req_offset / BLKSIZE;
+	if (first == o->o_next)
+		o->o_ra = o->o_ra ? MIN(o->o_ra * 2, RA_MAX) : RA_MIN;
+	else
+		o->o_ra = 0;
+
+	for (i = 0; i < n; i++) {
+		// Read the blocks in clusters of up to RA_MAX, and past
+		// the end of the request by the read-ahead window.
+		if (i % RA_MAX == 0) {
+			ra = (n - i <= RA_MAX) ? o->o_ra : 0;
+			file_prefetch(o->o_file, first + i,
+				      MIN(n - i, RA_MAX) + ra);
+		}
+		if ((r = file_get_block(o->o_file, first + i, &blk)) < 0
+		    || (r = sys_page_map(0, blk, 0, (void*) MAPVA + i*PGSIZE, perm)) < 0) {
+			if (i == 0)
+				goto out_err;
+			break;
+		}
+	}
+
+	o->o_next = first + i;
+	*pg_store = (void*) MAPVA;
+	*npages_store = i;
+	*perm_store = perm;
+	return i;
 
 out_err:
-	ipc_send(envid, r, 0, 0);
+	return r;
 }
 
-void
+int
 serve_close(envid_t envid, struct Fsreq_close *rq)
 {
 	struct OpenFile *o;
@@ -255,10 +311,10 @@ serve_close(envid_t envid, struct Fsreq_close *rq)
 	file_close(o->o_file);
 
 out:
-	ipc_send(envid, r, 0, 0);
+	return r;
 }
 
-void
+int
 serve_remove(envid_t envid, struct Fsreq_remove *rq)
 {
 	char path[MAXPATHLEN];
@@ -277,11 +333,10 @@ serve_remove(envid_t envid, struct Fsreq_remove *rq)
 	memcpy(path, rq->req_path, MAXPATHLEN);
 	path[MAXPATHLEN-1] = 0;
 
-	r = file_remove(path);
-	ipc_send(envid, r, 0, 0);
+	return file_remove(path);
 }
 
-void
+int
 serve_dirty(envid_t envid, struct Fsreq_dirty *rq)
 {
 	struct OpenFile *o;
@@ -300,63 +355,179 @@ serve_dirty(envid_t envid, struct Fsreq_dirty *rq)
 	r = file_dirty(o->o_file, rq->req_offset);
 
 out:
-	ipc_send(envid, r, 0, 0);
+	return r;
 }
 
-void
+// Preallocate disk blocks for part of an open file (see file_allocate),
+// growing it if need be.
+int
+serve_allocate(envid_t envid, struct Fsreq_allocate *rq)
+{
+	struct OpenFile *o;
+	int r;
+
+	if (debug)
+		cprintf("serve_allocate %08x %08x %08x %08x\n", envid,
+			rq->req_fileid, rq->req_offset, rq->req_len);
+
+	if ((r = openfile_lookup(envid, rq->req_fileid, &o)) < 0)
+		return r;
+	if ((o->o_mode & O_ACCMODE) == O_RDONLY)
+		return -E_INVAL;
+
+	r = file_allocate(o->o_file, rq->req_offset, rq->req_len);
+	o->o_fd->fd_file.file.f_size = o->o_file->f_size;
+	return r;
+}
+
+int
 serve_sync(envid_t envid)
 {
 	fs_sync();
-	ipc_send(envid, 0, 0, 0);
+	return 0;
+}
+
+// Periodic write-back, asked for by our flusher environment (see
+// flusher_start): write out the blocks that have been dirty a while.
+int
+serve_flush(envid_t envid)
+{
+	dirty_writeback();
+	return 0;
+}
+
+// Copy the buffer cache counters into 'st', which goes back to the
+// client in the reply's inline words.
+int
+serve_stats(envid_t envid, struct Fsstats *st)
+{
+	*st = bcache_stats;
+	return 0;
 }
 
 void
 serve(void)
 {
 	uint32_t req, whom;
-	int perm;
-	
+	uint32_t words[IPC_NWORDS], reply_words[IPC_NWORDS];
+	const uint32_t *rw;
+	int perm, r, reply_perm;
+	unsigned npages, i;
+	void *pg, *rq;
+
+	// Small requests arrive as inline words instead of a page;
+	// make sure they fit.
+	static_assert(sizeof(struct Fsreq_map) <= sizeof(words));
+	static_assert(sizeof(struct Fsreq_set_size) <= sizeof(words));
+	static_assert(sizeof(struct Fsreq_close) <= sizeof(words));
+	static_assert(sizeof(struct Fsreq_dirty) <= sizeof(words));
+	static_assert(sizeof(struct Fsreq_allocate) <= sizeof(words));
+	static_assert(sizeof(struct Fsstats) <= sizeof(reply_words));
+
+	// We have no caller yet, so this just waits.
+	req = ipc_reply_wait(0, 0, 0, 0, (int32_t *) &whom, (void *) REQVA,
+			     &perm, words);
 	while (1) {
-		perm = 0;
-		req = ipc_recv((int32_t *) &whom, (void *) REQVA, &perm);
 		if (debug)
 			cprintf("fs req %d from %08x [page %08x: %s]\n",
 				req, whom, vpt[VPN(REQVA)], REQVA);
 
-		// All requests must contain an argument page
-		if (!(perm & PTE_P)) {
-			cprintf("Invalid request from %08x: no argument page\n",
-				whom);
-			continue; // just leave it hanging...
-		}
+		// The request's arguments are in the page if one was sent,
+		// otherwise in the inline words.
+		rq = (perm & PTE_P) ? (void *) REQVA : (void *) words;
 
+		pg = 0;
+		npages = 1;
+		reply_perm = 0;
+		rw = 0;
 		switch (req) {
 		case FSREQ_OPEN:
-			serve_open(whom, (struct Fsreq_open*)REQVA);
+		case FSREQ_REMOVE:
+			// These requests don't fit in the inline words
+			if (!(perm & PTE_P)) {
+				cprintf("Invalid request from %08x: no argument page\n",
+					whom);
+				r = -E_INVAL;
+			} else if (req == FSREQ_OPEN)
+				r = serve_open(whom, (struct Fsreq_open*)rq,
+					       &pg, &reply_perm);
+			else
+				r = serve_remove(whom, (struct Fsreq_remove*)rq);
 			break;
 		case FSREQ_MAP:
-			serve_map(whom, (struct Fsreq_map*)REQVA);
+			r = serve_map(whom, (struct Fsreq_map*)rq,
+				      &pg, &npages, &reply_perm);
 			break;
 		case FSREQ_SET_SIZE:
-			serve_set_size(whom, (struct Fsreq_set_size*)REQVA);
+			r = serve_set_size(whom, (struct Fsreq_set_size*)rq);
 			break;
 		case FSREQ_CLOSE:
-			serve_close(whom, (struct Fsreq_close*)REQVA);
+			r = serve_close(whom, (struct Fsreq_close*)rq);
 			break;
 		case FSREQ_DIRTY:
-			serve_dirty(whom, (struct Fsreq_dirty*)REQVA);
-			break;
-		case FSREQ_REMOVE:
-			serve_remove(whom, (struct Fsreq_remove*)REQVA);
+			r = serve_dirty(whom, (struct Fsreq_dirty*)rq);
 			break;
 		case FSREQ_SYNC:
-			serve_sync(whom);
+			r = serve_sync(whom);
+			break;
+		case FSREQ_ALLOCATE:
+			r = serve_allocate(whom, (struct Fsreq_allocate*)rq);
+			break;
+		case FSREQ_FLUSH:
+			r = serve_flush(whom);
+			break;
+		case FSREQ_STATS:
+			r = serve_stats(whom, (struct Fsstats*)reply_words);
+			rw = reply_words;
 			break;
 		default:
 			cprintf("Invalid request code %d from %08x\n", whom, req);
+			r = -E_INVAL;
 			break;
 		}
-		sys_page_unmap(0, (void*) REQVA);
+		if (perm & PTE_P)
+			sys_page_unmap(0, (void*) REQVA);
+
+		// Answer this request and wait for the next one
+		// in a single system call.
+		if (pg) {
+			req = ipc_reply_wait(r, pg, npages, reply_perm,
+					     (int32_t *) &whom, (void *) REQVA,
+					     &perm, words);
+
+			// The client has its own mappings of the blocks
+			// we lined up at MAPVA now.
+			if (pg == (void*) MAPVA)
+				for (i = 0; i < npages; i++)
+					sys_page_unmap(0, (void*) MAPVA + i*PGSIZE);
+		} else
+			req = ipc_reply_waitw(r, rw, (int32_t *) &whom, &perm,
+					      words);
+	}
+}
+
+// Start an environment that sends us FSREQ_FLUSH every FLUSH_INTERVAL
+// clock ticks, so that dirty blocks reach the disk in the background.
+// This has to happen before we map any blocks: fork would make our
+// block pages copy-on-write.  The flusher doesn't get our I/O
+// privilege: sys_exofork clears IOPL in a child's trapframe.
+static void
+flusher_start(void)
+{
+	envid_t fs;
+	int r;
+
+	fs = sys_getenvid();
+	if ((r = fork()) < 0) {
+		cprintf("fs: no write-back flusher: %e\n", r);
+		return;
+	}
+	if (r == 0) {
+		binaryname = "fsflush";
+		while (1) {
+			sys_wait_any(0, 0, FLUSH_INTERVAL);
+			ipc_callw(fs, FSREQ_FLUSH, 0, 0);
+		}
 	}
 }
 
@@ -371,6 +542,7 @@ umain(void)
 	outw(0x8A00, 0x8A00);
 	cprintf("FS can do I/O\n");
 
+	flusher_start();
 	serve_init();
 	fs_init();
 	fs_test();
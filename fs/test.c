@@ -22,7 +22,16 @@ fs_test(void)
 	struct File *f;
 	int r;
 	char *blk;
-	uint32_t *bits;
+	uint32_t i, *bits;
+
+	// Every bitmap block is in memory, so that the bit of the last
+	// block on the disk can be read.  The default image has a single
+	// bitmap block; build one with more than BLKBITSIZE blocks
+	// (make FSNBLOCKS=40000, say) to test more.
+	for (i = 0; i < ROUNDUP(super->s_nblocks, BLKBITSIZE) / BLKBITSIZE; i++)
+		assert(block_is_mapped(2 + i));
+	assert(!block_is_free(2 + i - 1));
+	cprintf("read_bitmap maps the whole bitmap\n");
 
 	// back up bitmap
 	if ((r = sys_page_alloc(0, (void*) PGSIZE, PTE_P|PTE_U|PTE_W)) < 0)
@@ -74,6 +83,7 @@ fs_test(void)
 	file_flush(f);
 	assert(!(vpt[VPN(blk)] & PTE_D));
 	file_close(f);
+	fs_sync();
 	assert(!(vpt[VPN(f)] & PTE_D));	
 	cprintf("file rewrite is good\n");
 }
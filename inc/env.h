@@ -35,12 +35,44 @@ typedef int32_t envid_t;
 #define ENV_RUNNABLE		1
 #define ENV_NOT_RUNNABLE	2
 
+// Size of the x87/SSE state saved by FXSAVE.
+#define FXSAVE_SIZE		512
+
+// Besides its value, an IPC message can carry this many words inline.
+#define IPC_NWORDS		4
+
+// A message queued in an environment's mailbox (see sys_mbox_send).
+struct Mboxmsg {
+	envid_t mm_from;		// envid of the sender
+	uint32_t mm_value;		// data value sent
+};
+
+// A mailbox occupies one kernel page, which bounds its capacity.
+#define MBOX_MAXSLOTS		(PGSIZE / sizeof(struct Mboxmsg))
+
+// Something sys_wait_any can wait for.
+struct Waitev {
+	uint32_t we_type;		// one of the WAIT_ values below
+	uint32_t we_arg;		// envid or event id, depending on type
+};
+
+// Values of we_type in struct Waitev
+#define WAIT_IPC		1	// a message is queued for us
+#define WAIT_ENV		2	// environment we_arg has exited
+#define WAIT_EVENT		3	// event object we_arg was signaled
+
+// sys_wait_any waits for at most this many things at once.
+#define WAIT_MAXEVENTS		8
+
+LIST_HEAD(Env_list, Env);		// Declares 'struct Env_list'
+
 struct Env {
 	struct Trapframe env_tf;	// Saved registers
 	LIST_ENTRY(Env) env_link;	// Free list link pointers
 	envid_t env_id;			// Unique environment identifier
 	envid_t env_parent_id;		// env_id of this env's parent
 	unsigned env_status;		// Status of the environment
+	int env_exit_status;		// Status it exited with (see sys_env_exit)
 	uint32_t env_runs;		// Number of times environment has run
 
 	// Address space
@@ -53,9 +85,59 @@ struct Env {
 	// Lab 4 IPC
 	bool env_ipc_recving;		// env is blocked receiving
 	void *env_ipc_dstva;		// va at which to map received page
+	unsigned env_ipc_dstnpages;	// pages we accept, starting at dstva
 	uint32_t env_ipc_value;		// data value sent to us 
 	envid_t env_ipc_from;		// envid of the sender	
 	int env_ipc_perm;		// perm of page mapping received
+	unsigned env_ipc_npages;	// number of pages received
+	uint32_t env_ipc_words[IPC_NWORDS];	// inline words sent to us
+
+	// Blocking IPC send
+	bool env_ipc_sending;		// env is blocked in sys_ipc_send
+	envid_t env_ipc_to;		// envid of the receiver we wait for
+	uint32_t env_ipc_send_value;	// value we are sending
+	uint32_t env_ipc_send_words[IPC_NWORDS];	// inline words we are sending
+	void *env_ipc_srcva;		// va of the page we are sending
+	unsigned env_ipc_send_npages;	// number of pages we are sending
+	int env_ipc_send_perm;		// perm of the page we are sending
+	LIST_ENTRY(Env) env_ipc_link;	// Link in receiver's sender queue
+	struct Env_list env_ipc_senders;	// envs blocked sending to us
+	struct Env *env_ipc_senders_tail;	// last env in env_ipc_senders
+
+	// Call/reply IPC
+	bool env_ipc_calling;		// our queued send is a sys_ipc_call
+	envid_t env_ipc_recv_from;	// only accept a reply from this env
+	envid_t env_ipc_caller;		// caller to answer in sys_ipc_reply_wait
+
+	// Asynchronous mailbox
+	struct Page *env_mbox;		// page holding the slots, or null
+	uint32_t env_mbox_nslots;	// capacity, in messages
+	uint32_t env_mbox_head;		// slot of the oldest message
+	uint32_t env_mbox_count;	// number of messages queued
+	bool env_mbox_waiting;		// env is blocked in sys_mbox_recv
+
+	// Waiting for several events (see sys_wait_any)
+	bool env_waiting;		// env is blocked in sys_wait_any
+	bool env_wait_timed;		// give up at env_wait_deadline
+	uint32_t env_wait_deadline;	// clock tick to give up at
+	LIST_ENTRY(Env) env_wait_link;	// Link in the list of waiters
+	unsigned env_wait_n;		// number of events in env_wait_evs
+	struct Waitev env_wait_evs[WAIT_MAXEVENTS];	// what we wait for
+	int env_wait_status;		// exit status of the env we waited for
+
+	// User-level device drivers (see kern/irq.c)
+	bool env_irq_waiting;		// env is blocked in sys_irq_wait
+
+	// Console input
+	bool env_cgetc_waiting;		// env is blocked in sys_cgetc
+	LIST_ENTRY(Env) env_cgetc_link;	// Link in the queue of readers
+
+	// System call ring (see inc/ring.h)
+	struct Page *env_ring;		// page holding the ring, or null
+
+	// x87/SSE state, saved lazily (see kern/fpu.c)
+	bool env_fpu_used;		// env has FPU state to keep
+	uint8_t env_fpu[FXSAVE_SIZE] __attribute__((aligned(16)));
 };
 
 #endif // !JOS_INC_ENV_H
@@ -24,6 +24,9 @@
 #define E_FILE_EXISTS	13	// File already exists
 #define E_NOT_EXEC	14	// File not a valid executable
 
-#define MAXERROR	14
+#define E_MBOX_FULL	15	// Receiver's mailbox is full
+#define E_TIMEOUT	16	// Wait timed out
+
+#define MAXERROR	16
 
 #endif	// !JOS_INC_ERROR_H */
@@ -4,6 +4,7 @@
 #define JOS_INC_FS_H
 
 #include <inc/types.h>
+#include <inc/mmu.h>
 
 // File nodes (both in-memory and on-disk)
 
@@ -22,8 +23,14 @@
 #define NDIRECT		10
 // Number of direct block pointers in an indirect block
 #define NINDIRECT	(BLKSIZE / 4)
+// Number of blocks reached through the double-indirect block
+#define NDINDIRECT	(NINDIRECT * NINDIRECT)
 
+// Maximum file size, without and with FS_FEAT_DINDIRECT.  The latter is
+// well short of what the double-indirect block reaches, so that file
+// offsets fit in an off_t.
 #define MAXFILESIZE	(NINDIRECT * BLKSIZE)
+#define MAXBIGFILESIZE	0x40000000
 
 struct File {
 	char f_name[MAXNAMELEN];	// filename
@@ -34,6 +41,10 @@ struct File {
 	// A block is allocated iff its value is != 0.
 	uint32_t f_direct[NDIRECT];	// direct blocks
 	uint32_t f_indirect;		// indirect block
+	uint32_t f_dindirect;		// double-indirect block, for blocks
+					// NINDIRECT on (FS_FEAT_DINDIRECT)
+	uint32_t f_index;		// root of a directory's hashed index,
+					// if any (FS_FEAT_DIRINDEX)
 
 	// Points to the directory in which this file lives.
 	// Meaningful only in memory; the value on disk can be garbage.
@@ -42,7 +53,7 @@ struct File {
 
 	// Pad out to 256 bytes; must do arithmetic in case we're compiling
 	// fsformat on a 64-bit machine.
-	uint8_t f_pad[256 - MAXNAMELEN - 8 - 4*NDIRECT - 4 - sizeof(struct File*)];
+	uint8_t f_pad[256 - MAXNAMELEN - 8 - 4*NDIRECT - 12 - sizeof(struct File*)];
 } __attribute__((packed));	// required only on some 64-bit machines
 
 // An inode block contains exactly BLKFILES 'struct File's
@@ -57,12 +68,56 @@ struct File {
 
 #define FS_MAGIC	0x4A0530AE	// related vaguely to 'J\0S!'
 
+// Feature flags in s_features
+#define FS_FEAT_DINDIRECT	0x1	// files use f_dindirect
+#define FS_FEAT_DIRINDEX	0x2	// big directories have an f_index
+
 struct Super {
 	uint32_t s_magic;		// Magic number: FS_MAGIC
 	uint32_t s_nblocks;		// Total number of blocks on disk
 	struct File s_root;		// Root directory node
+	uint32_t s_features;		// FS_FEAT_* flags; 0 on old disks
+};
+
+// Hashed index of a directory's entries, kept in blocks of its own so
+// the directory itself keeps the plain format (see fs/dirindex.c).  Only
+// directories of more than DIRINDEX_MIN blocks have one.  It is an
+// extendible hash table: the low di_depth bits of a name's dir_hash
+// pick the bucket block that lists the entry.
+
+#define DIRINDEX_MIN		4
+#define DIRINDEX_MAXDEPTH	9
+#define DIRINDEX_MASK(depth)	((1 << (depth)) - 1)
+
+struct Dirindex {
+	uint32_t di_depth;		// hash bits that pick a bucket
+	uint32_t di_free;		// no entry slot below this one is free
+	uint32_t di_buckets[1 << DIRINDEX_MAXDEPTH];	// bucket blocks
+};
+
+#define DIRBUCKET_NENTS		((BLKSIZE - 8) / 8)
+
+struct Dirbucket {
+	uint32_t db_depth;		// low hash bits its entries all share
+	uint32_t db_count;		// entries in use
+	struct Dirent {
+		uint32_t de_hash;	// dir_hash of the name
+		uint32_t de_slot;	// block * BLKFILES + index in block
+	} db_ents[DIRBUCKET_NENTS];
 };
 
+// Hash of a file name for the directory index (32-bit FNV-1a).
+static __inline uint32_t
+dir_hash(const char *name)
+{
+	uint32_t h;
+
+	h = 2166136261U;
+	while (*name)
+		h = (h ^ (uint8_t) *name++) * 16777619U;
+	return h;
+}
+
 // Definitions for requests from clients to file system
 
 #define FSREQ_OPEN	1
@@ -72,6 +127,9 @@ struct Super {
 #define FSREQ_DIRTY	5
 #define FSREQ_REMOVE	6
 #define FSREQ_SYNC	7
+#define FSREQ_STATS	8
+#define FSREQ_FLUSH	9
+#define FSREQ_ALLOCATE	10
 
 struct Fsreq_open {
 	char req_path[MAXPATHLEN];
@@ -81,6 +139,7 @@ struct Fsreq_open {
 struct Fsreq_map {
 	int req_fileid;
 	off_t req_offset;
+	int req_npages;		// number of consecutive blocks wanted
 };
 
 struct Fsreq_set_size {
@@ -101,4 +160,18 @@ struct Fsreq_remove {
 	char req_path[MAXPATHLEN];
 };
 
+struct Fsreq_allocate {
+	int req_fileid;
+	off_t req_offset;
+	off_t req_len;
+};
+
+// Reply to FSREQ_STATS: buffer cache counters since the server started.
+struct Fsstats {
+	uint32_t st_hits;	// file blocks found already in memory
+	uint32_t st_misses;	// file blocks that had to be read from disk
+	uint32_t st_evictions;	// blocks dropped to make room
+	uint32_t st_writebacks;	// dirty blocks written out on eviction
+};
+
 #endif /* !JOS_INC_FS_H */
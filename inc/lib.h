@@ -21,6 +21,7 @@
 #include <inc/fd.h>
 #include <inc/args.h>
 #include <inc/malloc.h>
+#include <inc/ring.h>
 
 #define USED(x)		(void)(x)
 
@@ -30,6 +31,7 @@ extern volatile struct Env *env;
 extern volatile struct Env envs[NENV];
 extern volatile struct Page pages[];
 void	exit(void);
+void	exit_status(int status) __attribute__((noreturn));
 
 // pgfault.c
 void	set_pgfault_handler(void (*handler)(struct UTrapframe *utf));
@@ -42,7 +44,10 @@ void	sys_cputs(const char *string, size_t len);
 int	sys_cgetc(void);
 envid_t	sys_getenvid(void);
 int	sys_env_destroy(envid_t);
+void	sys_env_exit(int status) __attribute__((noreturn));
+int	sys_env_wait(envid_t env);
 void	sys_yield(void);
+void	sys_yield_to(envid_t env);
 static envid_t sys_exofork(void);
 int	sys_env_set_status(envid_t env, int status);
 int	sys_env_set_trapframe(envid_t env, struct Trapframe *tf);
@@ -53,7 +58,27 @@ int	sys_page_map(envid_t src_env, void *src_pg,
 		     envid_t dst_env, void *dst_pg, int perm);
 int	sys_page_unmap(envid_t env, void *pg);
 int	sys_ipc_try_send(envid_t to_env, uint32_t value, void *pg, int perm);
-int	sys_ipc_recv(void *rcv_pg);
+int	sys_ipc_send(envid_t to_env, uint32_t value, void *pg, int perm,
+		     unsigned npages);
+int	sys_ipc_recv(void *rcv_pg, unsigned npages);
+int	sys_ipc_call(envid_t to_env, uint32_t value, void *pg, int perm,
+		     void *rcv_pg, unsigned rcv_npages);
+int	sys_ipc_reply_wait(uint32_t value, void *pg, int perm, void *rcv_pg,
+			   unsigned npages, unsigned rcv_npages);
+int	sys_ipc_callw(envid_t to_env, uint32_t value, const uint32_t *words);
+int	sys_ipc_reply_waitw(uint32_t value, const uint32_t *words);
+int	sys_mbox_create(envid_t env, unsigned nslots);
+int	sys_mbox_send(envid_t to_env, uint32_t value);
+int	sys_mbox_recv(struct Mboxmsg *msgs, unsigned n);
+int	sys_ring_setup(void *va);
+int	sys_ring_enter(void);
+int	sys_event_alloc(void);
+int	sys_event_free(int evid);
+int	sys_event_signal(int evid);
+int	sys_wait_any(const struct Waitev *evs, unsigned n, int timeout);
+int	sys_irq_register(int irq);
+int	sys_irq_wait(void);
+int	sys_page_phys(void *va);
 
 // This must be inlined.  Exercise for reader: why?
 static __inline envid_t sys_exofork(void) __attribute__((always_inline));
@@ -72,6 +97,22 @@ sys_exofork(void)
 // ipc.c
 void	ipc_send(envid_t to_env, uint32_t value, void *pg, int perm);
 uint32_t ipc_recv(envid_t *from_env_store, void *pg, int *perm_store);
+void	ipc_send_pages(envid_t to_env, uint32_t value, void *pg,
+		       unsigned npages, int perm);
+uint32_t ipc_recv_pages(envid_t *from_env_store, void *pg, unsigned npages,
+			int *perm_store, unsigned *npages_store);
+uint32_t ipc_call(envid_t to_env, uint32_t value, void *pg, int perm,
+		  void *rcv_pg, unsigned rcv_npages, int *perm_store);
+uint32_t ipc_reply_wait(uint32_t value, void *pg, unsigned npages, int perm,
+			envid_t *from_env_store, void *rcv_pg, int *perm_store,
+			uint32_t *words_store);
+uint32_t ipc_callw(envid_t to_env, uint32_t value, const uint32_t *words,
+		   uint32_t *words_store);
+uint32_t ipc_reply_waitw(uint32_t value, const uint32_t *words,
+			 envid_t *from_env_store, int *perm_store,
+			 uint32_t *words_store);
+void	mbox_send(envid_t to_env, uint32_t value);
+int	mbox_recv(struct Mboxmsg *msgs, unsigned n);
 
 // fork.c
 #define	PTE_SHARE	0x400
@@ -93,17 +134,20 @@ int	stat(const char *path, struct Stat *statbuf);
 int	open(const char *path, int mode);
 int	read_map(int fd, off_t offset, void **blk);
 int	ftruncate(int fd, off_t size);
+int	fallocate(int fd, off_t offset, off_t len);
 int	remove(const char *path);
 int	sync(void);
 
 // fsipc.c
 int	fsipc_open(const char *path, int omode, struct Fd *fd);
-int	fsipc_map(int fileid, off_t offset, void *dst_va);
+int	fsipc_map(int fileid, off_t offset, int npages, void *dst_va);
 int	fsipc_set_size(int fileid, off_t size);
 int	fsipc_close(int fileid);
 int	fsipc_dirty(int fileid, off_t offset);
+int	fsipc_allocate(int fileid, off_t offset, off_t len);
 int	fsipc_remove(const char *path);
 int	fsipc_sync(void);
+int	fsipc_stats(struct Fsstats *st);
 
 // pageref.c
 int	pageref(void *addr);
@@ -123,7 +167,13 @@ int	pipe(int pipefds[2]);
 int	pipeisclosed(int pipefd);
 
 // wait.c
-void	wait(envid_t env);
+int	wait(envid_t env);
+
+// ring.c
+extern struct Ring *envring;
+int	ring_setup(struct Ring *r);
+int	ring_submit(struct Ring *r, const struct Ringsqe *sqe);
+int	ring_complete(struct Ring *r, struct Ringcqe *cqe);
 
 /* File open modes */
 #define	O_RDONLY	0x0000		/* open for reading only */
@@ -98,6 +98,8 @@
 #define CR0_CD		0x40000000	// Cache Disable
 #define CR0_PG		0x80000000	// Paging
 
+#define CR4_OSXMMEXCPT	0x00000400	// OS handles SIMD FP exceptions
+#define CR4_OSFXSR	0x00000200	// OS uses FXSAVE/FXRSTOR
 #define CR4_PCE		0x00000100	// Performance counter enable
 #define CR4_MCE		0x00000040	// Machine Check Enable
 #define CR4_PSE		0x00000010	// Page Size Extensions
@@ -129,6 +131,16 @@
 #define FL_VIP		0x00100000	// Virtual Interrupt Pending
 #define FL_ID		0x00200000	// ID flag
 
+// CPUID function 1 feature flags (in EDX)
+#define CPUID_FEAT_SEP	0x00000800	// SYSENTER/SYSEXIT
+#define CPUID_FEAT_FXSR	0x01000000	// FXSAVE/FXRSTOR
+#define CPUID_FEAT_SSE	0x02000000	// SSE
+
+// Model specific registers
+#define MSR_IA32_SYSENTER_CS	0x174	// Kernel code segment for SYSENTER
+#define MSR_IA32_SYSENTER_ESP	0x175	// Kernel stack pointer for SYSENTER
+#define MSR_IA32_SYSENTER_EIP	0x176	// Kernel entry point for SYSENTER
+
 // Page fault error codes
 #define FEC_PR		0x1	// Page fault caused by protection violation
 #define FEC_WR		0x2	// Page fault caused by a write
@@ -0,0 +1,43 @@
+#ifndef JOS_INC_RING_H
+#define JOS_INC_RING_H
+
+#include <inc/types.h>
+
+// A system call ring: one page shared between an environment and the
+// kernel (see sys_ring_setup).  The environment posts system calls
+// on the submission queue; the kernel runs them on sys_ring_enter,
+// or whenever the environment next traps, and posts their results
+// on the completion queue.
+//
+// Indices run freely and are reduced modulo the queue sizes.
+// The environment advances r_sq_tail and r_cq_head; the kernel
+// advances r_sq_head and r_cq_tail.
+
+#define RING_NSQE	64	// submission queue entries (power of 2)
+#define RING_NCQE	128	// completion queue entries (power of 2)
+
+// A system call to run.  Only calls that never block are accepted:
+// SYS_page_alloc, SYS_page_map, SYS_page_unmap, SYS_ipc_try_send
+// and SYS_mbox_send.
+struct Ringsqe {
+	uint32_t sqe_num;		// system call number
+	uint32_t sqe_args[5];		// its arguments
+	uint32_t sqe_tag;		// copied to the completion
+};
+
+// The result of a system call.
+struct Ringcqe {
+	uint32_t cqe_tag;		// sqe_tag of the submission
+	int32_t cqe_res;		// the system call's return value
+};
+
+struct Ring {
+	volatile uint32_t r_sq_head;
+	volatile uint32_t r_sq_tail;
+	volatile uint32_t r_cq_head;
+	volatile uint32_t r_cq_tail;
+	struct Ringsqe r_sq[RING_NSQE];
+	struct Ringcqe r_cq[RING_NCQE];
+};
+
+#endif	// !JOS_INC_RING_H
@@ -19,6 +19,26 @@ enum
 	SYS_yield,
 	SYS_ipc_try_send,
 	SYS_ipc_recv,
+	SYS_yield_to,
+	SYS_ipc_send,
+	SYS_ipc_call,
+	SYS_ipc_reply_wait,
+	SYS_ipc_callw,
+	SYS_ipc_reply_waitw,
+	SYS_mbox_create,
+	SYS_mbox_send,
+	SYS_mbox_recv,
+	SYS_ring_setup,
+	SYS_ring_enter,
+	SYS_event_alloc,
+	SYS_event_free,
+	SYS_event_signal,
+	SYS_wait_any,
+	SYS_env_exit,
+	SYS_env_wait,
+	SYS_irq_register,
+	SYS_irq_wait,
+	SYS_page_phys,
 	NSYSCALLS
 };
 
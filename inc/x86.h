@@ -36,6 +36,11 @@ static __inline uint32_t read_ebp(void) __attribute__((always_inline));
 static __inline uint32_t read_esp(void) __attribute__((always_inline));
 static __inline void cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp);
 static __inline uint64_t read_tsc(void) __attribute__((always_inline));
+static __inline void wrmsr(uint32_t msr, uint32_t lo, uint32_t hi) __attribute__((always_inline));
+static __inline void clts(void) __attribute__((always_inline));
+static __inline void fninit(void) __attribute__((always_inline));
+static __inline void fxsave(void *area) __attribute__((always_inline));
+static __inline void fxrstor(const void *area) __attribute__((always_inline));
 
 static __inline void
 breakpoint(void)
@@ -290,4 +295,35 @@ read_tsc(void)
         return tsc;
 }
 
+static __inline void
+wrmsr(uint32_t msr, uint32_t lo, uint32_t hi)
+{
+	__asm __volatile("wrmsr" : : "c" (msr), "a" (lo), "d" (hi));
+}
+
+static __inline void
+clts(void)
+{
+	__asm __volatile("clts");
+}
+
+static __inline void
+fninit(void)
+{
+	__asm __volatile("fninit");
+}
+
+// 'area' must be FXSAVE_SIZE bytes, 16-byte aligned.
+static __inline void
+fxsave(void *area)
+{
+	__asm __volatile("fxsave (%0)" : : "r" (area) : "memory");
+}
+
+static __inline void
+fxrstor(const void *area)
+{
+	__asm __volatile("fxrstor (%0)" : : "r" (area) : "memory");
+}
+
 #endif /* !JOS_INC_X86_H */
@@ -11,6 +11,7 @@
 
 
 void cons_intr(int (*proc)(void));
+static void cons_emit(int c);
 
 
 /***** Serial I/O code *****/
@@ -169,11 +170,11 @@ cga_putc(int c)
 		crt_pos -= (crt_pos % CRT_COLS);
 		break;
 	case '\t':
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
+		cons_emit(' ');
+		cons_emit(' ');
+		cons_emit(' ');
+		cons_emit(' ');
+		cons_emit(' ');
 		break;
 	default:
 		crt_buf[crt_pos++] = c;		/* write the character */
@@ -189,8 +190,14 @@ cga_putc(int c)
 			crt_buf[i] = 0x0700 | ' ';
 		crt_pos -= CRT_COLS;
 	}
+}
 
-	/* move that little blinky thing */
+// Move that little blinky thing to where cga_putc has got to.
+// This takes four slow port writes, so it is done once per batch
+// of characters rather than after each one.
+static void
+cga_setcursor(void)
+{
 	outb(addr_6845, 14);
 	outb(addr_6845 + 1, crt_pos >> 8);
 	outb(addr_6845, 15);
@@ -343,6 +350,7 @@ kbd_proc_data(void)
 	// Ctrl-Alt-Del: reboot
 	if (!(~shift & (CTL | ALT)) && c == KEY_DEL) {
 		cprintf("Rebooting!\n");
+		cons_flush();
 		outb(0x92, 0x3); // courtesy of Chris Frost
 	}
 
@@ -400,6 +408,10 @@ cons_getc(void)
 {
 	int c;
 
+	// Whoever reads input wants to see the output so far,
+	// such as a prompt or the echo of what was typed.
+	cons_flush();
+
 	// poll for any pending input characters,
 	// so that this function works even when interrupts are disabled
 	// (e.g., when called from the kernel monitor).
@@ -416,12 +428,72 @@ cons_getc(void)
 	return 0;
 }
 
+// Output is collected in a ring buffer and written out to the devices
+// in batches by cons_flush: on each clock tick, whenever somebody reads
+// console input, and when the buffer fills up.  So printing costs
+// little more than copying the characters, whatever the devices do.
+// After cons_sync, for panics, output goes straight to the devices.
+
+#define CONSOUTSIZE 4096
+
+static struct {
+	uint8_t buf[CONSOUTSIZE];
+	uint32_t rpos;		// runs freely; index modulo CONSOUTSIZE
+	uint32_t wpos;
+} consout;
+
+static bool cons_unbuffered;
+
+// write a character to the output devices
+static void
+cons_emit(int c)
+{
+	lpt_putc(c);
+	cga_putc(c);
+}
+
+// write out all buffered output
+void
+cons_flush(void)
+{
+	if (consout.rpos == consout.wpos)
+		return;
+	while (consout.rpos != consout.wpos)
+		cons_emit(consout.buf[consout.rpos++ % CONSOUTSIZE]);
+	cga_setcursor();
+}
+
+// write out buffered output, and stop buffering from now on
+void
+cons_sync(void)
+{
+	cons_flush();
+	cons_unbuffered = 1;
+}
+
 // output a character to the console
 void
 cons_putc(int c)
 {
-	lpt_putc(c);
-	cga_putc(c);
+	if (cons_unbuffered) {
+		cons_emit(c);
+		cga_setcursor();
+		return;
+	}
+
+	if (consout.wpos - consout.rpos == CONSOUTSIZE)
+		cons_flush();
+	consout.buf[consout.wpos++ % CONSOUTSIZE] = c;
+}
+
+// output the 'len' characters at 's' to the console
+void
+cons_write(const char *s, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		cons_putc(s[i]);
 }
 
 // initialize the console devices
@@ -19,6 +19,9 @@
 
 void cons_init(void);
 void cons_putc(int c);
+void cons_write(const char *s, size_t len);
+void cons_flush(void);
+void cons_sync(void);
 int cons_getc(void);
 
 void kbd_intr(void); // irq 1
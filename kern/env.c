@@ -12,10 +12,15 @@
 #include <kern/trap.h>
 #include <kern/monitor.h>
 #include <kern/sched.h>
+#include <kern/fpu.h>
+#include <kern/event.h>
+#include <kern/syscall.h>
+#include <kern/irq.h>
 
 struct Env *envs = NULL;		// All environments
 struct Env *curenv = NULL;	        // The current env
 static struct Env_list env_free_list;	// Free list
+static struct Env *env_free_tail;	// Last Env on env_free_list
 
 #define ENVGENSHIFT	12		// >= LOGNENV
 
@@ -63,6 +68,53 @@ envid2env(envid_t envid, struct Env **env_store, bool checkperm)
 	return 0;
 }
 
+//
+// Append 'snd' to the FIFO queue of environments blocked in
+// sys_ipc_send waiting for 'rcv' to receive.
+//
+void
+env_sendq_append(struct Env *rcv, struct Env *snd)
+{
+	if (LIST_EMPTY(&rcv->env_ipc_senders))
+		LIST_INSERT_HEAD(&rcv->env_ipc_senders, snd, env_ipc_link);
+	else
+		LIST_INSERT_AFTER(rcv->env_ipc_senders_tail, snd, env_ipc_link);
+	rcv->env_ipc_senders_tail = snd;
+}
+
+//
+// Remove 'snd' from the queue of environments blocked sending to 'rcv'.
+// Removing the head -- the common case -- is O(1); only removing the
+// tail of a longer queue walks it to find the new tail.
+//
+void
+env_sendq_remove(struct Env *rcv, struct Env *snd)
+{
+	struct Env *e;
+
+	LIST_REMOVE(snd, env_ipc_link);
+	if (rcv->env_ipc_senders_tail == snd) {
+		rcv->env_ipc_senders_tail = NULL;
+		LIST_FOREACH(e, &rcv->env_ipc_senders, env_ipc_link)
+			rcv->env_ipc_senders_tail = e;
+	}
+}
+
+//
+// Wake up 'e', which is blocked sending to or calling an environment
+// that is going away, and make its system call fail with -E_BAD_ENV.
+//
+static void
+env_ipc_abort(struct Env *e)
+{
+	e->env_ipc_sending = 0;
+	e->env_ipc_calling = 0;
+	e->env_ipc_recving = 0;
+	e->env_ipc_recv_from = 0;
+	e->env_tf.tf_regs.reg_eax = -E_BAD_ENV;
+	e->env_status = ENV_RUNNABLE;
+}
+
 //
 // Mark all environments in 'envs' as free, set their env_ids to 0,
 // and insert them into the env_free_list.
@@ -82,6 +134,7 @@ env_init(void)
 
 		LIST_INSERT_HEAD(&env_free_list, &envs[i], env_link);
 	}
+	env_free_tail = &envs[NENV-1];
 }
 
 //
@@ -168,6 +221,7 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 	// Set the basic status variables.
 	e->env_parent_id = parent_id;
 	e->env_status = ENV_RUNNABLE;
+	e->env_exit_status = 0;
 	e->env_runs = 0;
 
 	// Clear out all the saved register state,
@@ -195,8 +249,33 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 	// Clear the page fault handler until user installs one.
 	e->env_pgfault_upcall = 0;
 
-	// Also clear the IPC receiving flag.
+	// Also clear the IPC receiving flag and the sender queue.
 	e->env_ipc_recving = 0;
+	e->env_ipc_sending = 0;
+	LIST_INIT(&e->env_ipc_senders);
+	e->env_ipc_senders_tail = NULL;
+	e->env_ipc_calling = 0;
+	e->env_ipc_recv_from = 0;
+	e->env_ipc_caller = 0;
+
+	// No mailbox until one is created.
+	e->env_mbox = NULL;
+	e->env_mbox_nslots = 0;
+	e->env_mbox_head = 0;
+	e->env_mbox_count = 0;
+	e->env_mbox_waiting = 0;
+
+	// Not waiting for anything.
+	e->env_waiting = 0;
+	e->env_wait_n = 0;
+	e->env_cgetc_waiting = 0;
+	e->env_irq_waiting = 0;
+
+	// No system call ring until one is set up.
+	e->env_ring = NULL;
+
+	// The FPU state is set up on first use.
+	e->env_fpu_used = 0;
 
 	// If this is the file server (e == &envs[1]) give it I/O privileges.
 	// LAB 5: Your code here.
@@ -204,6 +283,8 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 		e->env_tf.tf_eflags |= FL_IOPL_3;
 
 	// commit the allocation
+	if (e == env_free_tail)
+		env_free_tail = NULL;
 	LIST_REMOVE(e, env_link);
 	*newenv_store = e;
 
@@ -407,13 +488,55 @@ env_create(uint8_t *binary, size_t size)
 void
 env_free(struct Env *e)
 {
+	int i;
 	pte_t *pt;
 	uint32_t pdeno, pteno;
 	physaddr_t pa;
+	struct Env *snd;
 
 	// Note the environment's demise.
 	// cprintf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
 
+	// Fail the sends and calls of anybody blocked sending to us or
+	// waiting for our reply, and leave the sender queue we are
+	// blocked on, if any.
+	while ((snd = LIST_FIRST(&e->env_ipc_senders)) != NULL) {
+		env_sendq_remove(e, snd);
+		env_ipc_abort(snd);
+	}
+	for (i = 0; i < NENV; i++)
+		if (envs[i].env_status != ENV_FREE
+		    && envs[i].env_ipc_recving
+		    && envs[i].env_ipc_recv_from == e->env_id)
+			env_ipc_abort(&envs[i]);
+	if (e->env_ipc_sending) {
+		env_sendq_remove(&envs[ENVX(e->env_ipc_to)], e);
+		e->env_ipc_sending = 0;
+	}
+
+	// Stop waiting, and free our event objects.
+	wait_cancel(e);
+	cgetc_cancel(e);
+	irq_release(e);
+	event_release(e);
+
+	// Drop the FPU state.
+	fpu_release(e);
+
+	// Let go of the system call ring.
+	if (e->env_ring) {
+		page_decref(e->env_ring);
+		e->env_ring = NULL;
+	}
+
+	// Free the mailbox; queued messages are dropped.
+	if (e->env_mbox) {
+		page_decref(e->env_mbox);
+		e->env_mbox = NULL;
+		e->env_mbox_nslots = 0;
+		e->env_mbox_count = 0;
+	}
+
 	// Flush all mapped pages in the user portion of the address space
 	static_assert(UTOP % PTSIZE == 0);
 	for (pdeno = 0; pdeno < PDX(UTOP); pdeno++) {
@@ -443,9 +566,18 @@ env_free(struct Env *e)
 	e->env_cr3 = 0;
 	page_decref(pa2page(pa));
 
-	// return the environment to the free list
+	// return the environment to the free list, at the tail, so that
+	// its id and exit status last until every other free Env has
+	// been reused (see sys_env_wait)
 	e->env_status = ENV_FREE;
-	LIST_INSERT_HEAD(&env_free_list, e, env_link);
+	if (env_free_tail)
+		LIST_INSERT_AFTER(env_free_tail, e, env_link);
+	else
+		LIST_INSERT_HEAD(&env_free_list, e, env_link);
+	env_free_tail = e;
+
+	// Wake anybody waiting for us to exit.
+	wait_notify_all();
 }
 
 //
@@ -507,6 +639,11 @@ env_run(struct Env *e)
 	curenv = e;
 	e->env_runs++;
 	lcr3(e->env_cr3);
+	fpu_switch(e);
+
+	// The next trap from user mode saves e's state straight into
+	// e->env_tf.
+	ts.ts_esp0 = (uintptr_t) (&e->env_tf + 1);
 	env_pop_tf(&e->env_tf);
 }
 
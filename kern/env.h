@@ -14,8 +14,6 @@
 extern struct Env *envs;		// All environments
 extern struct Env *curenv;	        // Current environment
 
-LIST_HEAD(Env_list, Env);		// Declares 'struct Env_list'
-
 void	env_init(void);
 int	env_alloc(struct Env **e, envid_t parent_id);
 void	env_free(struct Env *e);
@@ -23,6 +21,8 @@ void	env_create(uint8_t *binary, size_t size);
 void	env_destroy(struct Env *e);	// Does not return if e == curenv
 
 int	envid2env(envid_t envid, struct Env **env_store, bool checkperm);
+void	env_sendq_append(struct Env *rcv, struct Env *snd);
+void	env_sendq_remove(struct Env *rcv, struct Env *snd);
 // The following two functions do not return
 void	env_run(struct Env *e) __attribute__((noreturn));
 void	env_pop_tf(struct Trapframe *tf) __attribute__((noreturn));
@@ -0,0 +1,261 @@
+/* See COPYRIGHT for copyright information. */
+
+// Event objects, and waiting for several things at once.
+//
+// An event object is a flag in the kernel that any environment knowing
+// its id can set (signal).  An environment blocked in sys_wait_any
+// sleeps until one of the things it listed happens: a message is
+// queued for it, some environment exits, or an event object is
+// signaled.  Waiting for an event object clears its flag, so a signal
+// sent before the wait starts is not lost.
+//
+// Blocked waiters sit on a list.  Whoever makes one of the things
+// happen calls wait_notify or wait_notify_all, which re-check the
+// waiters' lists and wake those that are done.
+
+#include <inc/error.h>
+#include <inc/assert.h>
+
+#include <kern/env.h>
+#include <kern/event.h>
+
+// Event ids are built like envids: a uniqueifier above the index
+// into 'events', so that a stale id never names a new event.
+#define LOG2NEVENT		10
+#define NEVENT			(1 << LOG2NEVENT)
+#define EVENTX(evid)		((evid) & (NEVENT - 1))
+
+struct Event {
+	int32_t ev_id;			// Unique event identifier
+	envid_t ev_owner;		// env that allocated it, 0 if free
+	bool ev_signaled;		// signaled since last waited for
+};
+
+static struct Event events[NEVENT];
+
+// Environments blocked in sys_wait_any.
+static struct Env_list waiters = LIST_HEAD_INITIALIZER(waiters);
+
+// Clock ticks since boot, for timeouts.
+static uint32_t ticks;
+
+// Return the live event called 'evid', or null if there is none.
+static struct Event *
+event_lookup(int32_t evid)
+{
+	struct Event *ev;
+
+	if (evid <= 0)
+		return NULL;
+	ev = &events[EVENTX(evid)];
+	if (!ev->ev_owner || ev->ev_id != evid)
+		return NULL;
+	return ev;
+}
+
+// Allocate an unsignaled event object owned by 'owner'.
+// Returns its id, or -E_NO_MEM if all event objects are in use.
+int
+event_alloc(struct Env *owner)
+{
+	int32_t generation;
+	struct Event *ev;
+
+	for (ev = events; ev < events + NEVENT; ev++)
+		if (!ev->ev_owner)
+			break;
+	if (ev == events + NEVENT)
+		return -E_NO_MEM;
+
+	generation = (ev->ev_id + NEVENT) & ~(NEVENT - 1);
+	if (generation <= 0)
+		generation = NEVENT;
+	ev->ev_id = generation | (ev - events);
+	ev->ev_owner = owner->env_id;
+	ev->ev_signaled = 0;
+	return ev->ev_id;
+}
+
+static void
+event_destroy(struct Event *ev)
+{
+	ev->ev_owner = 0;
+	ev->ev_signaled = 0;
+}
+
+// Free event object 'evid', which 'owner' must own.  Anybody waiting
+// for it gets -E_INVAL.
+// Returns 0 on success, -E_INVAL if there is no such event or
+// 'owner' doesn't own it.
+int
+event_free(struct Env *owner, int32_t evid)
+{
+	struct Event *ev;
+
+	if (!(ev = event_lookup(evid)) || ev->ev_owner != owner->env_id)
+		return -E_INVAL;
+
+	event_destroy(ev);
+	wait_notify_all();
+	return 0;
+}
+
+// Signal event object 'evid', waking an environment waiting for it.
+// Returns 0 on success, -E_INVAL if there is no such event.
+int
+event_signal(int32_t evid)
+{
+	struct Event *ev;
+
+	if (!(ev = event_lookup(evid)))
+		return -E_INVAL;
+
+	ev->ev_signaled = 1;
+	wait_notify_all();
+	return 0;
+}
+
+// Free all the event objects 'owner' owns; it is going away.
+void
+event_release(struct Env *owner)
+{
+	struct Event *ev;
+	bool freed;
+
+	freed = 0;
+	for (ev = events; ev < events + NEVENT; ev++)
+		if (ev->ev_owner == owner->env_id) {
+			event_destroy(ev);
+			freed = 1;
+		}
+	if (freed)
+		wait_notify_all();
+}
+
+// Check the things 'e' is waiting for, in order.
+// Returns the index of the first that has happened, clearing it if it
+// is an event object; -E_INVAL if an event object it names is gone;
+// or -E_TIMEOUT if nothing has happened yet.
+static int
+wait_poll(struct Env *e)
+{
+	unsigned i;
+	struct Waitev *we;
+	struct Env *t;
+	struct Event *ev;
+
+	for (i = 0; i < e->env_wait_n; i++) {
+		we = &e->env_wait_evs[i];
+		switch (we->we_type) {
+		case WAIT_IPC:
+			if (!LIST_EMPTY(&e->env_ipc_senders)
+			    || e->env_mbox_count)
+				return i;
+			break;
+		case WAIT_ENV:
+			// A freed Env keeps its id and exit status
+			// until it is reused; after that, the status
+			// is lost.
+			t = &envs[ENVX(we->we_arg)];
+			if (t->env_id != (envid_t) we->we_arg) {
+				e->env_wait_status = -E_BAD_ENV;
+				return i;
+			}
+			if (t->env_status == ENV_FREE) {
+				e->env_wait_status = t->env_exit_status;
+				return i;
+			}
+			break;
+		case WAIT_EVENT:
+			if (!(ev = event_lookup(we->we_arg)))
+				return -E_INVAL;
+			if (ev->ev_signaled) {
+				ev->ev_signaled = 0;
+				return i;
+			}
+			break;
+		}
+	}
+	return -E_TIMEOUT;
+}
+
+// Stop 'e' waiting and make 'r' the result of its sys_wait_any.
+static void
+wait_wake(struct Env *e, int r)
+{
+	LIST_REMOVE(e, env_wait_link);
+	e->env_waiting = 0;
+	e->env_tf.tf_regs.reg_eax = r;
+	e->env_status = ENV_RUNNABLE;
+}
+
+// Wait on behalf of 'e' for the things in its env_wait_evs, giving up
+// after 'timeout' clock ticks; a negative 'timeout' means forever.
+// If something has already happened, return at once.  Otherwise,
+// unless 'timeout' is 0, mark 'e' as blocked; wait_notify will fill
+// in the result when it wakes 'e'.
+//
+// Returns the result of wait_poll, or 0 if 'e' blocked.
+int
+wait_any(struct Env *e, int32_t timeout)
+{
+	int r;
+
+	r = wait_poll(e);
+	if (r != -E_TIMEOUT || timeout == 0)
+		return r;
+
+	e->env_waiting = 1;
+	e->env_wait_timed = timeout > 0;
+	e->env_wait_deadline = ticks + timeout;
+	LIST_INSERT_HEAD(&waiters, e, env_wait_link);
+	e->env_status = ENV_NOT_RUNNABLE;
+	return 0;
+}
+
+// Something 'e' may be waiting for has happened: wake it if so.
+void
+wait_notify(struct Env *e)
+{
+	int r;
+
+	if (e->env_waiting && (r = wait_poll(e)) != -E_TIMEOUT)
+		wait_wake(e, r);
+}
+
+// Something any waiter may be waiting for has happened.
+void
+wait_notify_all(void)
+{
+	struct Env *e, *next;
+
+	for (e = LIST_FIRST(&waiters); e; e = next) {
+		next = LIST_NEXT(e, env_wait_link);
+		wait_notify(e);
+	}
+}
+
+// Stop 'e' waiting without waking it; it is going away.
+void
+wait_cancel(struct Env *e)
+{
+	if (e->env_waiting) {
+		LIST_REMOVE(e, env_wait_link);
+		e->env_waiting = 0;
+	}
+}
+
+// Count a clock tick and time out the waiters whose time is up.
+void
+wait_tick(void)
+{
+	struct Env *e, *next;
+
+	ticks++;
+	for (e = LIST_FIRST(&waiters); e; e = next) {
+		next = LIST_NEXT(e, env_wait_link);
+		if (e->env_wait_timed
+		    && (int32_t) (ticks - e->env_wait_deadline) >= 0)
+			wait_wake(e, -E_TIMEOUT);
+	}
+}
@@ -0,0 +1,24 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_EVENT_H
+#define JOS_KERN_EVENT_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+struct Env;
+
+int event_alloc(struct Env *owner);
+int event_free(struct Env *owner, int32_t evid);
+int event_signal(int32_t evid);
+void event_release(struct Env *owner);
+
+int wait_any(struct Env *e, int32_t timeout);
+void wait_notify(struct Env *e);
+void wait_notify_all(void);
+void wait_cancel(struct Env *e);
+void wait_tick(void);
+
+#endif	// !JOS_KERN_EVENT_H
@@ -0,0 +1,104 @@
+/* See COPYRIGHT for copyright information. */
+
+// Lazy x87/SSE context switching.
+//
+// The FPU holds the state of at most one environment, fpu_owner.
+// Whenever another environment runs, CR0.TS is set, so its first FPU
+// or SSE instruction raises a device-not-available trap (T_DEVICE).
+// Only then is the owner's state saved with FXSAVE and the current
+// environment's loaded with FXRSTOR.  Environments that never touch
+// the FPU never pay for it.
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/assert.h>
+#include <inc/string.h>
+
+#include <kern/env.h>
+#include <kern/fpu.h>
+
+// The environment whose state is in the FPU, if any.
+static struct Env *fpu_owner;
+
+// The FPU state an environment starts out with.
+static uint8_t fpu_initial[FXSAVE_SIZE] __attribute__((aligned(16)));
+
+void
+fpu_init(void)
+{
+	uint32_t edx, cr4;
+
+	cpuid(1, 0, 0, 0, &edx);
+	if (!(edx & CPUID_FEAT_FXSR))
+		panic("fpu_init: no FXSAVE/FXRSTOR");
+
+	// Tell the CPU we save SSE state and handle SIMD exceptions.
+	// CR0_MP and CR0_NE were set in i386_vm_init.
+	cr4 = rcr4() | CR4_OSFXSR;
+	if (edx & CPUID_FEAT_SSE)
+		cr4 |= CR4_OSXMMEXCPT;
+	lcr4(cr4);
+
+	// Record the power-up state, then let the first user trap.
+	clts();
+	fninit();
+	fxsave(fpu_initial);
+	lcr0(rcr0() | CR0_TS);
+}
+
+// Handle a device-not-available trap from user mode:
+// give the FPU to the current environment.
+void
+fpu_trap(struct Trapframe *tf)
+{
+	assert(curenv && (tf->tf_cs & 3) == 3);
+
+	clts();
+	if (fpu_owner == curenv)
+		return;
+
+	if (fpu_owner)
+		fxsave(fpu_owner->env_fpu);
+	if (curenv->env_fpu_used)
+		fxrstor(curenv->env_fpu);
+	else {
+		fxrstor(fpu_initial);
+		curenv->env_fpu_used = 1;
+	}
+	fpu_owner = curenv;
+}
+
+// Called when 'e' is about to run: let it use the FPU freely
+// only if its state is already loaded.
+void
+fpu_switch(struct Env *e)
+{
+	if (e == fpu_owner)
+		clts();
+	else
+		lcr0(rcr0() | CR0_TS);
+}
+
+// Give 'dst' a copy of 'src's FPU state, as sys_exofork does with
+// the registers.  'src' must be the current environment.
+void
+fpu_copy(struct Env *dst, struct Env *src)
+{
+	dst->env_fpu_used = src->env_fpu_used;
+	if (!src->env_fpu_used)
+		return;
+
+	// An owner runs with CR0.TS clear, so this doesn't trap.
+	if (fpu_owner == src)
+		fxsave(src->env_fpu);
+	memmove(dst->env_fpu, src->env_fpu, FXSAVE_SIZE);
+}
+
+// Forget about 'e's FPU state; 'e' is being freed.
+void
+fpu_release(struct Env *e)
+{
+	if (fpu_owner == e)
+		fpu_owner = NULL;
+	e->env_fpu_used = 0;
+}
@@ -0,0 +1,19 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_FPU_H
+#define JOS_KERN_FPU_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/trap.h>
+
+struct Env;
+
+void fpu_init(void);
+void fpu_trap(struct Trapframe *tf);
+void fpu_switch(struct Env *e);
+void fpu_copy(struct Env *dst, struct Env *src);
+void fpu_release(struct Env *e);
+
+#endif	// !JOS_KERN_FPU_H
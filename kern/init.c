@@ -12,6 +12,7 @@
 #include <kern/trap.h>
 #include <kern/sched.h>
 #include <kern/picirq.h>
+#include <kern/fpu.h>
 
 // Wrapper to sched_yield()
 //
@@ -49,6 +50,7 @@ i386_init(void)
 	// Lab 3 user environment initialization functions
 	env_init();
 	idt_init();
+	fpu_init();
 
 	// Lab 4 multitasking initialization functions
 	pic_init();
@@ -101,6 +103,9 @@ _panic(const char *file, int line, const char *fmt,...)
 		goto dead;
 	panicstr = fmt;
 
+	// The system may be in no shape to drain the console later.
+	cons_sync();
+
 	va_start(ap, fmt);
 	cprintf("kernel panic at %s:%d: ", file, line);
 	vcprintf(fmt, ap);
@@ -0,0 +1,126 @@
+/* See COPYRIGHT for copyright information. */
+
+// Hardware interrupts handled by user-level drivers.
+//
+// A driver environment registers for an IRQ and then loops in
+// sys_irq_wait.  When the IRQ fires, the kernel masks it at the PIC,
+// acknowledges it, and wakes the driver, or remembers it as pending
+// if the driver is busy.  The IRQ stays masked until the driver
+// waits again, so it never has to deal with an interrupt storm from
+// a device it hasn't serviced yet.
+
+#include <inc/error.h>
+#include <inc/mmu.h>
+
+#include <kern/env.h>
+#include <kern/irq.h>
+#include <kern/picirq.h>
+
+// IRQs the kernel handles itself: the clock, the keyboard, the cascade
+// from the slave PIC and the serial port.
+#define IRQ_KERNEL	((1 << 0) | (1 << 1) | (1 << IRQ_SLAVE) | (1 << 4))
+
+static envid_t irq_owner[MAX_IRQS];	// driver for each IRQ, or 0
+static uint16_t irq_pending;		// IRQs fired since last waited for
+
+// Make 'e' the driver for 'irq'.  Only environments with I/O
+// privileges can drive devices.
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if irq is out of range or handled by the kernel.
+//	-E_BAD_ENV if 'e' lacks I/O privileges, or another environment
+//		already drives irq.
+int
+irq_register(struct Env *e, int irq)
+{
+	if (irq < 0 || irq >= MAX_IRQS || (IRQ_KERNEL & (1 << irq)))
+		return -E_INVAL;
+	if ((e->env_tf.tf_eflags & FL_IOPL_MASK) != FL_IOPL_3)
+		return -E_BAD_ENV;
+	if (irq_owner[irq] && irq_owner[irq] != e->env_id)
+		return -E_BAD_ENV;
+
+	irq_owner[irq] = e->env_id;
+	irq_pending &= ~(1 << irq);
+	irq_unmask(irq);
+	return 0;
+}
+
+// Return the lowest pending IRQ 'e' drives, or -1 if there is none.
+static int
+irq_first_pending(struct Env *e)
+{
+	int irq;
+
+	for (irq = 0; irq < MAX_IRQS; irq++)
+		if ((irq_pending & (1 << irq)) && irq_owner[irq] == e->env_id)
+			return irq;
+	return -1;
+}
+
+// 'e' has serviced its devices and waits for the next interrupt from
+// any of them.  Unmask its IRQs; if one is already pending, take it,
+// otherwise mark 'e' as blocked.
+// Returns the IRQ taken, or -E_INVAL if 'e' drives no IRQs.
+// Returns 0 if 'e' blocked; irq_deliver fills in the result.
+int
+irq_wait(struct Env *e)
+{
+	int irq;
+	bool any;
+
+	any = 0;
+	for (irq = 0; irq < MAX_IRQS; irq++)
+		if (irq_owner[irq] == e->env_id) {
+			irq_unmask(irq);
+			any = 1;
+		}
+	if (!any)
+		return -E_INVAL;
+
+	if ((irq = irq_first_pending(e)) >= 0) {
+		irq_pending &= ~(1 << irq);
+		return irq;
+	}
+
+	e->env_irq_waiting = 1;
+	e->env_status = ENV_NOT_RUNNABLE;
+	return 0;
+}
+
+// Handle 'irq' if a driver environment has registered for it.
+// Returns true if so.
+bool
+irq_deliver(int irq)
+{
+	struct Env *e;
+
+	if (!irq_owner[irq])
+		return 0;
+
+	irq_mask(irq);
+	irq_eoi(irq);
+
+	e = &envs[ENVX(irq_owner[irq])];
+	if (e->env_irq_waiting) {
+		e->env_irq_waiting = 0;
+		e->env_tf.tf_regs.reg_eax = irq;
+		e->env_status = ENV_RUNNABLE;
+	} else
+		irq_pending |= 1 << irq;
+	return 1;
+}
+
+// Give up the IRQs 'e' drives; it is going away.
+void
+irq_release(struct Env *e)
+{
+	int irq;
+
+	for (irq = 0; irq < MAX_IRQS; irq++)
+		if (irq_owner[irq] == e->env_id) {
+			irq_mask(irq);
+			irq_owner[irq] = 0;
+			irq_pending &= ~(1 << irq);
+		}
+	e->env_irq_waiting = 0;
+}
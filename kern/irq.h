@@ -0,0 +1,18 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_IRQ_H
+#define JOS_KERN_IRQ_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+struct Env;
+
+int irq_register(struct Env *e, int irq);
+int irq_wait(struct Env *e);
+bool irq_deliver(int irq);
+void irq_release(struct Env *e);
+
+#endif	// !JOS_KERN_IRQ_H
@@ -67,15 +67,23 @@ pic_init(void)
 		irq_setmask_8259A(irq_mask_8259A);
 }
 
-void
-irq_setmask_8259A(uint16_t mask)
+static void
+pic_setmask(uint16_t mask)
 {
-	int i;
 	irq_mask_8259A = mask;
 	if (!didinit)
 		return;
 	outb(IO_PIC1+1, (char)mask);
 	outb(IO_PIC2+1, (char)(mask >> 8));
+}
+
+void
+irq_setmask_8259A(uint16_t mask)
+{
+	int i;
+	pic_setmask(mask);
+	if (!didinit)
+		return;
 	cprintf("enabled interrupts:");
 	for (i = 0; i < 16; i++)
 		if (~mask & (1<<i))
@@ -83,3 +91,26 @@ irq_setmask_8259A(uint16_t mask)
 	cprintf("\n");
 }
 
+/* Mask or unmask one IRQ, quietly: this happens on every interrupt
+ * delivered to a user-level driver. */
+void
+irq_mask(int irq)
+{
+	pic_setmask(irq_mask_8259A | (1 << irq));
+}
+
+void
+irq_unmask(int irq)
+{
+	pic_setmask(irq_mask_8259A & ~(1 << irq));
+}
+
+/* Acknowledge 'irq'.  The master runs in automatic EOI mode,
+ * but the slave needs an explicit end-of-interrupt. */
+void
+irq_eoi(int irq)
+{
+	if (irq >= 8)
+		outb(IO_PIC2, 0x20);	/* OCW2: non-specific EOI */
+}
+
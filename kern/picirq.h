@@ -24,6 +24,9 @@
 extern uint16_t irq_mask_8259A;
 void pic_init(void);
 void irq_setmask_8259A(uint16_t mask);
+void irq_mask(int irq);
+void irq_unmask(int irq);
+void irq_eoi(int irq);
 
 #endif // !__ASSEMBLER__
 
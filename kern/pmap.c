@@ -861,6 +861,7 @@ user_mem_assert(struct Env *env, const void *va, size_t len, int perm)
 	if (user_mem_check(env, va, len, perm | PTE_U) < 0) {
 		cprintf("[%08x] user_mem_check assertion failure for "
 			"va %08x\n", curenv->env_id, user_mem_check_addr);
+		env->env_exit_status = -E_FAULT;
 		env_destroy(env);	// may not return
 	}
 }
@@ -4,6 +4,7 @@
 #include <inc/error.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/ring.h>
 
 #include <kern/env.h>
 #include <kern/pmap.h>
@@ -11,6 +12,9 @@
 #include <kern/syscall.h>
 #include <kern/console.h>
 #include <kern/sched.h>
+#include <kern/fpu.h>
+#include <kern/event.h>
+#include <kern/irq.h>
 
 // Print a string to the system console.
 // The string is exactly 'len' characters long.
@@ -24,23 +28,75 @@ sys_cputs(const char *s, size_t len)
 	// LAB 3: Your code here.
 	user_mem_assert(curenv, s, len, PTE_U);
 
-	// Print the string supplied by the user.
-	cprintf("%.*s", len, s);
+	// Print the string supplied by the user.  This only queues
+	// it; the console writes it out later (see cons_flush).
+	cons_write(s, len);
 }
 
+// Environments blocked in sys_cgetc, oldest first.
+static struct Env_list cgetc_waiters = LIST_HEAD_INITIALIZER(cgetc_waiters);
+static struct Env *cgetc_waiters_tail;
+
 // Read a character from the system console.
+// The cons_getc() primitive doesn't wait for a character, but the
+// sys_cgetc() system call does: if there is no input, the environment
+// blocks until the keyboard or serial interrupt brings some (see
+// cgetc_deliver).  Blocked readers get characters in the order they
+// started waiting, and a new reader doesn't jump the queue.
 // Returns the character.
 static int
 sys_cgetc(void)
 {
 	int c;
 
-	// The cons_getc() primitive doesn't wait for a character,
-	// but the sys_cgetc() system call does.
-	while ((c = cons_getc()) == 0)
-		/* do nothing */;
+	if (LIST_EMPTY(&cgetc_waiters) && (c = cons_getc()) != 0)
+		return c;
+
+	if (LIST_EMPTY(&cgetc_waiters))
+		LIST_INSERT_HEAD(&cgetc_waiters, curenv, env_cgetc_link);
+	else
+		LIST_INSERT_AFTER(cgetc_waiters_tail, curenv, env_cgetc_link);
+	cgetc_waiters_tail = curenv;
+	curenv->env_cgetc_waiting = 1;
+	curenv->env_status = ENV_NOT_RUNNABLE;
+
+	// The real return value is filled in by cgetc_deliver.
+	return 0;
+}
+
+// Take 'e' off the queue of environments blocked in sys_cgetc.
+void
+cgetc_cancel(struct Env *e)
+{
+	struct Env *w;
+
+	if (!e->env_cgetc_waiting)
+		return;
 
-	return c;
+	LIST_REMOVE(e, env_cgetc_link);
+	e->env_cgetc_waiting = 0;
+	if (cgetc_waiters_tail == e) {
+		cgetc_waiters_tail = NULL;
+		LIST_FOREACH(w, &cgetc_waiters, env_cgetc_link)
+			cgetc_waiters_tail = w;
+	}
+}
+
+// Hand buffered console input to the environments blocked in
+// sys_cgetc, one character each, oldest reader first, and wake them.
+// Called after keyboard and serial interrupts.
+void
+cgetc_deliver(void)
+{
+	int c;
+	struct Env *e;
+
+	while ((e = LIST_FIRST(&cgetc_waiters)) != NULL
+	       && (c = cons_getc()) != 0) {
+		cgetc_cancel(e);
+		e->env_tf.tf_regs.reg_eax = c;
+		e->env_status = ENV_RUNNABLE;
+	}
 }
 
 // Returns the current environment's envid.
@@ -51,6 +107,8 @@ sys_getenvid(void)
 }
 
 // Destroy a given environment (possibly the currently running environment).
+// An environment destroyed by another exits with status -E_UNSPECIFIED;
+// one that destroys itself exits with status 0.
 //
 // Returns 0 on success, < 0 on error.  Errors are:
 //	-E_BAD_ENV if environment envid doesn't currently exist,
@@ -63,10 +121,52 @@ sys_env_destroy(envid_t envid)
 
 	if ((r = envid2env(envid, &e, 1)) < 0)
 		return r;
+	if (e != curenv)
+		e->env_exit_status = -E_UNSPECIFIED;
 	env_destroy(e);
 	return 0;
 }
 
+// Destroy the current environment, leaving 'status' for anybody
+// waiting for it to exit (see sys_env_wait).
+// Does not return.
+static void
+sys_env_exit(int status)
+{
+	curenv->env_exit_status = status;
+	env_destroy(curenv);
+}
+
+// Block until environment 'envid' exits, and store its exit status in
+// our env_wait_status.  A freed Env remembers its id and exit status
+// until it is reused, which env_free puts off as long as it can (freed
+// Envs go to the back of the free list), so if 'envid' has exited we
+// return at once.  If its slot is reused while we wait, the status
+// stored is -E_BAD_ENV.
+// Environments that die of a fault exit with status -E_FAULT.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if there is no environment 'envid' and it hasn't
+//		exited recently enough to know its status.
+//	-E_INVAL if envid is the current environment.
+static int
+sys_env_wait(envid_t envid)
+{
+	struct Env *e;
+
+	if (envid <= 0)
+		return -E_BAD_ENV;
+	e = &envs[ENVX(envid)];
+	if (e->env_id != envid)
+		return -E_BAD_ENV;
+	if (e == curenv)
+		return -E_INVAL;
+
+	curenv->env_wait_evs[0] = (struct Waitev) { WAIT_ENV, envid };
+	curenv->env_wait_n = 1;
+	return wait_any(curenv, -1);
+}
+
 // Deschedule current environment and pick a different one to run.
 // The system call returns 0.
 static void
@@ -75,6 +175,23 @@ sys_yield(void)
 	sched_yield();
 }
 
+// Hand the CPU directly to environment 'envid' if it is runnable,
+// instead of round-robining through every other runnable environment.
+// Falls back to sched_yield() if 'envid' doesn't exist, isn't runnable,
+// or is the current environment.
+// The system call returns 0.
+static void
+sys_yield_to(envid_t envid)
+{
+	struct Env *e;
+
+	if (envid2env(envid, &e, 0) == 0 && e != curenv
+	    && e->env_status == ENV_RUNNABLE)
+		env_run(e);
+
+	sched_yield();
+}
+
 // Allocate a new environment.
 // Returns envid of new environment, or < 0 on error.  Errors are:
 //	-E_NO_FREE_ENV if no free environment is available.
@@ -97,6 +214,11 @@ sys_exofork(void)
 	e->env_status = ENV_NOT_RUNNABLE;
 	e->env_tf = curenv->env_tf;
 	e->env_tf.tf_regs.reg_eax = 0;
+	// I/O privilege belongs to the file server alone; its children
+	// don't inherit it.  (sys_env_set_trapframe can't grant it
+	// either.)
+	e->env_tf.tf_eflags &= ~FL_IOPL_MASK;
+	fpu_copy(e, curenv);
 
 	return e->env_id;
 }
@@ -133,7 +255,8 @@ sys_env_set_status(envid_t envid, int status)
 
 // Set envid's trap frame to 'tf'.
 // tf is modified to make sure that user environments always run at code
-// protection level 3 (CPL 3) with interrupts enabled.
+// protection level 3 (CPL 3) with interrupts enabled, and without I/O
+// privilege, which only the kernel grants (see env_alloc).
 //
 // Returns 0 on success, < 0 on error.  Errors are:
 //	-E_BAD_ENV if environment envid doesn't currently exist,
@@ -166,6 +289,7 @@ sys_env_set_trapframe(envid_t envid, struct Trapframe *tf)
 	e->env_tf.tf_ss = GD_UD | 3;
 	e->env_tf.tf_cs = GD_UT | 3;
 	e->env_tf.tf_eflags |= FL_IF;
+	e->env_tf.tf_eflags &= ~FL_IOPL_MASK;
 
 	return 0;
 }
@@ -305,10 +429,12 @@ sys_page_alloc(envid_t envid, void *va, int perm)
 	return 0;
 }
 
-// Does the actual page map work
+// Find the page at 'srcva' in 'srcenv' for page_map, checking that it
+// may be mapped at 'dstva' in 'dstenv' with 'perm'.
+// Returns 0 and sets '*ppp' on success, -E_INVAL otherwise.
 static int
-page_map(struct Env *srcenv, void *srcva,
-	 struct Env *dstenv, void *dstva, int perm)
+page_map_source(struct Env *srcenv, void *srcva, struct Env *dstenv,
+		void *dstva, int perm, struct Page **ppp)
 {
 	pte_t *pte;
 	struct Page *pp;
@@ -325,6 +451,30 @@ page_map(struct Env *srcenv, void *srcva,
 			return -E_INVAL;
 	}
 
+	// A system call ring is drained with its environment's rights,
+	// so no other environment may map it, and it must stay writable
+	// where it is: copy-on-write would leave the kernel reading the
+	// old page.  Only its permissions may be set again.
+	if (pp == srcenv->env_ring
+	    && (dstenv != srcenv || dstva != srcva || !(perm & PTE_W)))
+		return -E_INVAL;
+
+	*ppp = pp;
+	return 0;
+}
+
+// Does the actual page map work
+static int
+page_map(struct Env *srcenv, void *srcva,
+	 struct Env *dstenv, void *dstva, int perm)
+{
+	int err;
+	struct Page *pp;
+
+	err = page_map_source(srcenv, srcva, dstenv, dstva, perm, &pp);
+	if (err < 0)
+		return err;
+
 	// the real job...
 	return page_insert(dstenv->env_pgdir, pp, dstva, perm);
 }
@@ -344,6 +494,8 @@ page_map(struct Env *srcenv, void *srcva,
 //	-E_INVAL if perm is inappropriate (see sys_page_alloc).
 //	-E_INVAL if (perm & PTE_W), but srcva is read-only in srcenvid's
 //		address space.
+//	-E_INVAL if srcva is srcenvid's system call ring, unless it is
+//		just being remapped in place, writable.
 //	-E_NO_MEM if there's no memory to allocate the new page,
 //		or to allocate any necessary page tables.
 static int
@@ -416,6 +568,226 @@ sys_page_unmap(envid_t envid, void *va)
 	return 0;
 }
 
+// Check the 'srcva', 'npages' and 'perm' arguments of an IPC send,
+// which grants the 'npages' pages starting at 'srcva'.
+// A null 'srcva' means no page is being sent.
+//
+// Return 0 if they are ok, -E_INVAL otherwise.
+static int
+check_ipc_srcva(void *srcva, unsigned npages, unsigned perm)
+{
+	if (!srcva)
+		return 0;
+
+	if ((uintptr_t) srcva >= UTOP)
+		return -E_INVAL;
+
+	if ((uintptr_t) srcva % PGSIZE)
+		return -E_INVAL;
+
+	if (npages == 0 || npages > (UTOP - (uintptr_t) srcva) / PGSIZE)
+		return -E_INVAL;
+
+	return check_page_perm(perm);
+}
+
+// Check the 'dstva' and 'npages' arguments of an IPC receive, which
+// accepts up to 'npages' pages starting at 'dstva'.
+// Any 'dstva' >= UTOP means no page is wanted.
+//
+// Return 0 if they are ok, -E_INVAL otherwise.
+static int
+check_ipc_dstva(void *dstva, unsigned npages)
+{
+	if ((uintptr_t) dstva >= UTOP)
+		return 0;
+
+	if ((uintptr_t) dstva % PGSIZE)
+		return -E_INVAL;
+
+	if (npages == 0 || npages > (UTOP - (uintptr_t) dstva) / PGSIZE)
+		return -E_INVAL;
+
+	return 0;
+}
+
+// Map the 'npages' pages starting at 'srcva' in 'srcenv' at 'dstva' in
+// 'dstenv', as page_map does for one page.  Either all of them are
+// mapped or, on error, none are.
+//
+// Returns 0 on success, < 0 on error.
+static int
+page_map_range(struct Env *srcenv, void *srcva,
+	       struct Env *dstenv, void *dstva, unsigned npages, int perm)
+{
+	int err;
+	unsigned i;
+	struct Page *pp;
+
+	// Check every source page and make every page table the range
+	// needs before mapping anything, so that no page_map below can
+	// fail after earlier ones have replaced what was mapped there.
+	for (i = 0; i < npages; i++) {
+		if ((err = page_map_source(srcenv, srcva + i * PGSIZE, dstenv,
+					   dstva + i * PGSIZE, perm, &pp)) < 0)
+			return err;
+		if (!pgdir_walk(dstenv->env_pgdir, dstva + i * PGSIZE, 1))
+			return -E_NO_MEM;
+	}
+
+	for (i = 0; i < npages; i++)
+		if ((err = page_map(srcenv, srcva + i * PGSIZE,
+				    dstenv, dstva + i * PGSIZE, perm)) < 0)
+			panic("page_map_range: page_map: %e", err);
+	return 0;
+}
+
+// Can 'sndenv' deliver a message to 'recenv' right now?
+// True if 'recenv' is receiving and, if it is blocked in sys_ipc_call,
+// its request has been delivered and 'sndenv' is the environment it is
+// waiting for a reply from.
+static bool
+ipc_can_deliver(struct Env *sndenv, struct Env *recenv)
+{
+	// A caller whose request is still queued isn't waiting for
+	// anything yet.
+	if (!recenv->env_ipc_recving || recenv->env_ipc_sending)
+		return 0;
+
+	return !recenv->env_ipc_recv_from
+		|| recenv->env_ipc_recv_from == sndenv->env_id;
+}
+
+// Deliver 'value', the IPC_NWORDS inline 'words' (all zero if 'words'
+// is null), and the 'npages' pages at 'srcva' in 'sndenv' if 'srcva'
+// is not null, to 'recenv', which must be waiting to receive, and wake
+// it up.  The receiver's window limits how many of the pages are
+// transferred: if it isn't asking for pages, none are.  The number of
+// pages transferred is stored in the receiver's env_ipc_npages.
+// On error the receiver is left waiting.
+//
+// A message from a sender blocked in sys_ipc_call makes the sender the
+// receiver's current caller (see sys_ipc_reply_wait).  A receiver
+// blocked in sys_ipc_call gets 'value' as the system call's result.
+//
+// Returns the number of pages mapped, or < 0 on error.
+static int
+ipc_deliver(struct Env *sndenv, struct Env *recenv, uint32_t value,
+	    const uint32_t *words, void *srcva, unsigned npages,
+	    unsigned perm)
+{
+	int err, ret;
+
+	ret = 0;
+	if (srcva && (uintptr_t) recenv->env_ipc_dstva < UTOP) {
+		ret = MIN(npages, recenv->env_ipc_dstnpages);
+		err = page_map_range(sndenv, srcva, recenv,
+				     recenv->env_ipc_dstva, ret, perm);
+		if (err)
+			return err;
+	}
+
+	if (recenv->env_ipc_recv_from)
+		recenv->env_tf.tf_regs.reg_eax = value;
+
+	recenv->env_ipc_recving = 0;
+	recenv->env_ipc_recv_from = 0;
+	recenv->env_ipc_caller = sndenv->env_ipc_calling ? sndenv->env_id : 0;
+	recenv->env_ipc_perm = ret ? perm : 0;
+	recenv->env_ipc_npages = ret;
+	recenv->env_ipc_from = sndenv->env_id;
+	recenv->env_ipc_value = value;
+	if (words)
+		memmove(recenv->env_ipc_words, words,
+			sizeof(recenv->env_ipc_words));
+	else
+		memset(recenv->env_ipc_words, 0, sizeof(recenv->env_ipc_words));
+	recenv->env_status = ENV_RUNNABLE;
+
+	return ret;
+}
+
+// Queue the current environment, which is sending 'value', 'words'
+// and the 'npages' pages at 'srcva' (as for ipc_deliver), on 'recenv's
+// sender queue.  The caller marks it not runnable.
+static void
+ipc_enqueue_sender(struct Env *recenv, uint32_t value,
+		   const uint32_t *words, void *srcva, unsigned npages,
+		   unsigned perm)
+{
+	curenv->env_ipc_sending = 1;
+	curenv->env_ipc_to = recenv->env_id;
+	curenv->env_ipc_send_value = value;
+	if (words)
+		memmove(curenv->env_ipc_send_words, words,
+			sizeof(curenv->env_ipc_send_words));
+	else
+		memset(curenv->env_ipc_send_words, 0,
+		       sizeof(curenv->env_ipc_send_words));
+	curenv->env_ipc_srcva = srcva;
+	curenv->env_ipc_send_npages = npages;
+	curenv->env_ipc_send_perm = perm;
+	env_sendq_append(recenv, curenv);
+	wait_notify(recenv);
+}
+
+// Take queued sender 'sndenv' off 'recenv's sender queue and deliver
+// its message.  The sender gets the result of its system call and is
+// woken up, unless it is a caller whose message went through: callers
+// stay blocked until the reply arrives.
+//
+// Returns the result of ipc_deliver.
+static int
+ipc_dequeue_sender(struct Env *recenv, struct Env *sndenv)
+{
+	int r;
+	bool calling;
+
+	env_sendq_remove(recenv, sndenv);
+	sndenv->env_ipc_sending = 0;
+
+	r = ipc_deliver(sndenv, recenv, sndenv->env_ipc_send_value,
+			sndenv->env_ipc_send_words, sndenv->env_ipc_srcva,
+			sndenv->env_ipc_send_npages, sndenv->env_ipc_send_perm);
+
+	calling = sndenv->env_ipc_calling;
+	sndenv->env_ipc_calling = 0;
+	if (calling && r >= 0)
+		return r;
+
+	sndenv->env_ipc_recving = 0;
+	sndenv->env_ipc_recv_from = 0;
+	sndenv->env_tf.tf_regs.reg_eax = r;
+	sndenv->env_status = ENV_RUNNABLE;
+	return r;
+}
+
+// Start receiving up to 'npages' pages at 'dstva' on behalf of 'e'.
+// If some environment is already queued sending to 'e', take the first
+// message that can be delivered and leave 'e' runnable.
+// Otherwise mark 'e' as blocked receiving.
+//
+// Returns 0 if a message was received, 1 if 'e' blocked.
+static int
+ipc_wait(struct Env *e, void *dstva, unsigned npages)
+{
+	struct Env *snd;
+
+	e->env_ipc_dstva = (uintptr_t) dstva < UTOP ? dstva : (void *) UTOP;
+	e->env_ipc_dstnpages = npages;
+	e->env_ipc_recv_from = 0;
+
+	// A sender whose page can't be mapped gets the error
+	// and we move on to the next one.
+	while ((snd = LIST_FIRST(&e->env_ipc_senders)) != NULL)
+		if (ipc_dequeue_sender(e, snd) >= 0)
+			return 0;
+
+	e->env_ipc_recving = 1;
+	e->env_status = ENV_NOT_RUNNABLE;
+	return 1;
+}
+
 // Try to send 'value' to the target env 'envid'.
 // If va != 0, then also send page currently mapped at 'va',
 // so that receiver gets a duplicate mapping of the same page.
@@ -452,92 +824,632 @@ sys_page_unmap(envid_t envid, void *va)
 static int
 sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 {
-	int err, ret;
-	struct Env *recenv, *sndenv;
+	int err;
+	struct Env *recenv;
 
 	// LAB 4: Your code here.
-	if (srcva) {
-		if ((uintptr_t) srcva >= UTOP)
-			return -E_INVAL;
-
-		if ((uintptr_t) srcva % PGSIZE)
-			return -E_INVAL;
-
-		if (check_page_perm(perm))
-			return -E_INVAL;
-	}
+	err = check_ipc_srcva(srcva, 1, perm);
+	if (err)
+		return err;
 
 	err = envid2env(envid, &recenv, 0);
 	if (err)
 		return err;
 
-	if (!recenv->env_ipc_recving)
+	if (!ipc_can_deliver(curenv, recenv))
 		return -E_IPC_NOT_RECV;
 
-	err = envid2env(0, &sndenv, 0);
+	return ipc_deliver(curenv, recenv, value, NULL, srcva, 1, perm);
+}
+
+// Send 'value' (and the page at 'srcva', as in sys_ipc_try_send)
+// to the target env 'envid', blocking until the target receives it.
+// Unlike sys_ipc_try_send, the 'npages' contiguous pages starting at
+// 'srcva' are granted, or as many of them as the target's receive
+// window allows (see sys_ipc_recv).
+//
+// If the target is not currently blocked in sys_ipc_recv, the caller
+// is appended to the target's env_ipc_senders queue and marked not
+// runnable.  The target's next sys_ipc_recv takes the first queued
+// sender, completes the transfer, stores the result in the sender's
+// saved %eax and marks it runnable again.  So senders are served in
+// FIFO order and never get scheduled just to fail.
+//
+// Returns the number of pages mapped on success, < 0 on error.
+// Errors are those of sys_ipc_try_send, except that it never
+// fails with -E_IPC_NOT_RECV.  Additional errors are:
+//	-E_INVAL if envid is the current environment.
+//	-E_INVAL if srcva < UTOP and npages is 0 or the pages extend
+//		beyond UTOP.
+//	-E_BAD_ENV if the target is destroyed before receiving.
+static int
+sys_ipc_send(envid_t envid, uint32_t value, void *srcva, unsigned perm,
+	     unsigned npages)
+{
+	int err;
+	struct Env *recenv;
+
+	err = check_ipc_srcva(srcva, npages, perm);
 	if (err)
 		return err;
 
-	ret = 0;
-	recenv->env_ipc_perm = 0;
-	recenv->env_ipc_recving = 0;
+	err = envid2env(envid, &recenv, 0);
+	if (err)
+		return err;
 
-	if (srcva && (uintptr_t) recenv->env_ipc_dstva < UTOP) {
-		err = page_map(sndenv, srcva, recenv, recenv->env_ipc_dstva,
-			       perm);
-		if (err)
-			return err;
-		recenv->env_ipc_perm = perm;
-		ret = 1;
-	}
+	if (recenv == curenv)
+		return -E_INVAL;
 
-	recenv->env_ipc_from = curenv->env_id;
-	recenv->env_ipc_value = value;
-	recenv->env_status = ENV_RUNNABLE;
+	if (ipc_can_deliver(curenv, recenv))
+		return ipc_deliver(curenv, recenv, value, NULL, srcva, npages,
+				   perm);
 
-	return ret;
+	ipc_enqueue_sender(recenv, value, NULL, srcva, npages, perm);
+	curenv->env_status = ENV_NOT_RUNNABLE;
+
+	// The real return value is filled in by sys_ipc_recv.
+	return 0;
 }
 
 // Block until a value is ready.  Record that you want to receive
 // using the env_ipc_recving and env_ipc_dstva fields of struct Env,
 // mark yourself not runnable, and then give up the CPU.
 //
+// If some environment is already blocked in sys_ipc_send to us,
+// take its message right away and return without blocking.
+//
 // If 'dstva' is < UTOP, then you are willing to receive a page of data.
 // 'dstva' is the virtual address at which the sent page should be mapped.
+// A sender can grant up to 'npages' contiguous pages, which are mapped
+// starting at 'dstva'; env_ipc_npages is set to the number mapped.
 //
 // This function only returns on error, but the system call will eventually
 // return 0 on success.
 // Return < 0 on error.  Errors are:
 //	-E_INVAL if dstva < UTOP but dstva is not page-aligned.
+//	-E_INVAL if dstva < UTOP and npages is 0 or the window extends
+//		beyond UTOP.
 static int
-sys_ipc_recv(void *dstva)
+sys_ipc_recv(void *dstva, unsigned npages)
 {
 	int err;
-	struct Env *e;
 
 	// LAB 4: Your code here.
-	err = envid2env(0, &e, 0);
+	err = check_ipc_dstva(dstva, npages);
 	if (err)
 		return err;
 
-	e->env_ipc_dstva = (void *) UTOP;
+	ipc_wait(curenv, dstva, npages);
+	return 0;
+}
 
-	if ((uintptr_t) dstva < UTOP) {
-		if ((uintptr_t) dstva % PGSIZE)
-			return -E_INVAL;
-		e->env_ipc_dstva = dstva;
+// Send 'value', 'words' and the page at 'srcva' to 'srvenv' on behalf
+// of the current environment and block waiting for the reply, which
+// is to be received in the window of 'dstnpages' pages at 'dstva'.  Switches to the server if it is
+// runnable.  The arguments must have been checked.
+//
+// Returns < 0 on error; otherwise doesn't return if the server
+// was run, and returns 0 if the current environment just blocked.
+static int
+ipc_call(struct Env *srvenv, uint32_t value, const uint32_t *words,
+	 void *srcva, unsigned perm, void *dstva, unsigned dstnpages)
+{
+	int err;
+
+	if (srvenv == curenv)
+		return -E_INVAL;
+
+	curenv->env_ipc_calling = 1;
+	if (ipc_can_deliver(curenv, srvenv)) {
+		err = ipc_deliver(curenv, srvenv, value, words, srcva, 1, perm);
+		curenv->env_ipc_calling = 0;
+		if (err < 0)
+			return err;
+	} else
+		ipc_enqueue_sender(srvenv, value, words, srcva, 1, perm);
+
+	// Wait for the reply, which sets our saved %eax.
+	curenv->env_ipc_dstva = (uintptr_t) dstva < UTOP ? dstva : (void *) UTOP;
+	curenv->env_ipc_dstnpages = dstnpages;
+	curenv->env_ipc_recv_from = srvenv->env_id;
+	curenv->env_ipc_recving = 1;
+	curenv->env_status = ENV_NOT_RUNNABLE;
+
+	if (srvenv->env_status == ENV_RUNNABLE)
+		env_run(srvenv);
+	return 0;
+}
+
+// Send 'value' (and the page at 'srcva', as in sys_ipc_send) to the
+// server 'envid' and wait for its reply, all in one system call.
+// The reply's pages, if any, are mapped in the window of 'dstnpages'
+// pages at 'dstva', and the reply's sender, permissions, page count
+// and inline words are stored in env_ipc_from, env_ipc_perm,
+// env_ipc_npages and env_ipc_words, as for sys_ipc_recv.
+// Only 'envid' can reply.
+//
+// If the server is runnable the kernel switches to it directly,
+// rather than going through the scheduler.
+//
+// Returns the reply value on success.  Errors are those of sys_ipc_send,
+// plus:
+//	-E_INVAL if the reply window is bad (see sys_ipc_recv).
+//	-E_BAD_ENV if the server is destroyed before replying.
+// A reply page that can't be mapped is reported as an error, too.
+static int
+sys_ipc_call(envid_t envid, uint32_t value, void *srcva, unsigned perm,
+	     void *dstva, unsigned dstnpages)
+{
+	int err;
+	struct Env *srvenv;
+
+	err = check_ipc_srcva(srcva, 1, perm);
+	if (err)
+		return err;
+
+	err = check_ipc_dstva(dstva, dstnpages);
+	if (err)
+		return err;
+
+	err = envid2env(envid, &srvenv, 0);
+	if (err)
+		return err;
+
+	return ipc_call(srvenv, value, NULL, srcva, perm, dstva, dstnpages);
+}
+
+// Like sys_ipc_call, but the request is 'value' plus the IPC_NWORDS
+// words w1..w4, all passed in registers; no page is sent and none is
+// accepted in the reply.  Small requests use this to avoid mapping a
+// request page in the server.
+static int
+sys_ipc_callw(envid_t envid, uint32_t value, uint32_t w1, uint32_t w2,
+	      uint32_t w3, uint32_t w4)
+{
+	int err;
+	struct Env *srvenv;
+	uint32_t words[IPC_NWORDS] = { w1, w2, w3, w4 };
+
+	err = envid2env(envid, &srvenv, 0);
+	if (err)
+		return err;
+
+	return ipc_call(srvenv, value, words, NULL, 0, (void *) UTOP, 0);
+}
+
+// Reply 'value', 'words' and the 'npages' pages at 'srcva' to the
+// current caller -- the environment whose sys_ipc_call delivered the
+// last message we received -- then wait for the next message in the
+// window of 'dstnpages' pages at 'dstva'.
+// If there is no caller, or it has gone away, only the wait happens.
+// If the reply can't be delivered, the caller gets the error instead.
+// If no message is waiting, switches directly back to the caller.
+// The arguments must have been checked.
+static void
+ipc_reply_wait(uint32_t value, const uint32_t *words, void *srcva,
+	       unsigned npages, unsigned perm, void *dstva,
+	       unsigned dstnpages)
+{
+	int err;
+	struct Env *caller;
+
+	caller = NULL;
+	if (curenv->env_ipc_caller
+	    && envid2env(curenv->env_ipc_caller, &caller, 0) == 0
+	    && caller->env_ipc_recving
+	    && caller->env_ipc_recv_from == curenv->env_id) {
+		err = ipc_deliver(curenv, caller, value, words, srcva, npages,
+				  perm);
+		if (err < 0) {
+			caller->env_ipc_recving = 0;
+			caller->env_ipc_recv_from = 0;
+			caller->env_tf.tf_regs.reg_eax = err;
+			caller->env_status = ENV_RUNNABLE;
+		}
+	} else
+		caller = NULL;
+	curenv->env_ipc_caller = 0;
+
+	if (ipc_wait(curenv, dstva, dstnpages) && caller
+	    && caller->env_status == ENV_RUNNABLE) {
+		curenv->env_tf.tf_regs.reg_eax = 0;
+		env_run(caller);
 	}
+}
 
-	e->env_ipc_recving = 1;
-	e->env_status = ENV_NOT_RUNNABLE;
+// Reply to the current caller with 'value' (and the 'npages' pages at
+// 'srcva', as in sys_ipc_send), then wait for the next message as in
+// sys_ipc_recv with a window of 'dstnpages' pages at 'dstva'.
+// See ipc_reply_wait.
+//
+// Returns 0 once a message has been received.  Errors are:
+//	-E_INVAL if srcva, npages or perm is bad (see sys_ipc_send),
+//		or the window is bad (see sys_ipc_recv).
+static int
+sys_ipc_reply_wait(uint32_t value, void *srcva, unsigned perm, void *dstva,
+		   unsigned npages, unsigned dstnpages)
+{
+	int err;
+
+	err = check_ipc_srcva(srcva, npages, perm);
+	if (err)
+		return err;
+
+	err = check_ipc_dstva(dstva, dstnpages);
+	if (err)
+		return err;
+
+	ipc_reply_wait(value, NULL, srcva, npages, perm, dstva, dstnpages);
+	return 0;
+}
+
+// Like sys_ipc_reply_wait, but the reply is 'value' plus the IPC_NWORDS
+// words w1..w4 in registers and no page.  The next message is received
+// into the same page window as the previous one.
+//
+// Returns 0 once a message has been received.
+static int
+sys_ipc_reply_waitw(uint32_t value, uint32_t w1, uint32_t w2, uint32_t w3,
+		    uint32_t w4)
+{
+	uint32_t words[IPC_NWORDS] = { w1, w2, w3, w4 };
+
+	ipc_reply_wait(value, words, NULL, 0, 0, curenv->env_ipc_dstva,
+		       curenv->env_ipc_dstnpages);
+	return 0;
+}
+
+// Give environment 'envid' a mailbox with room for 'nslots' messages,
+// or remove its mailbox if 'nslots' is 0.  A mailbox that already exists
+// is resized in place; if it already has 'nslots' slots, nothing changes,
+// so the sender and the receiver can both create it.  Messages can then
+// be queued to 'envid' with sys_mbox_send without waiting for it to
+// receive.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if nslots > MBOX_MAXSLOTS, or the mailbox still holds
+//		messages.
+//	-E_NO_MEM if there's no memory for the mailbox.
+static int
+sys_mbox_create(envid_t envid, unsigned nslots)
+{
+	int err;
+	struct Env *e;
+	struct Page *pp;
+
+	err = envid2env(envid, &e, 1);
+	if (err)
+		return err;
+
+	if (e->env_mbox && nslots == e->env_mbox_nslots)
+		return 0;
+	if (nslots > MBOX_MAXSLOTS || e->env_mbox_count)
+		return -E_INVAL;
+
+	if (nslots == 0) {
+		if (e->env_mbox)
+			page_decref(e->env_mbox);
+		e->env_mbox = NULL;
+	} else if (!e->env_mbox) {
+		err = page_alloc(&pp);
+		if (err)
+			return err;
+		pp->pp_ref++;
+		e->env_mbox = pp;
+	}
+	e->env_mbox_nslots = nslots;
+	e->env_mbox_head = 0;
+	return 0;
+}
+
+// Queue 'value' in the mailbox of environment 'envid' and return
+// without waiting for it to be received.  If 'envid' is blocked in
+// sys_mbox_recv it is woken up.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist.
+//	-E_INVAL if envid has no mailbox.
+//	-E_MBOX_FULL if envid's mailbox is full.
+static int
+sys_mbox_send(envid_t envid, uint32_t value)
+{
+	int err;
+	struct Env *e;
+	struct Mboxmsg *slots;
+
+	err = envid2env(envid, &e, 0);
+	if (err)
+		return err;
+
+	if (!e->env_mbox)
+		return -E_INVAL;
+	if (e->env_mbox_count == e->env_mbox_nslots)
+		return -E_MBOX_FULL;
+
+	slots = page2kva(e->env_mbox);
+	slots[(e->env_mbox_head + e->env_mbox_count) % e->env_mbox_nslots] =
+		(struct Mboxmsg) { curenv->env_id, value };
+	e->env_mbox_count++;
+
+	if (e->env_mbox_waiting) {
+		e->env_mbox_waiting = 0;
+		e->env_tf.tf_regs.reg_eax = 0;
+		e->env_status = ENV_RUNNABLE;
+	}
+	wait_notify(e);
+	return 0;
+}
+
+// Move up to 'n' messages, oldest first, from the current environment's
+// mailbox into the array 'msgs'.  If the mailbox is empty, block until a
+// message arrives; the system call then returns 0 and should be retried,
+// by which time more messages may have been queued.
+//
+// Returns the number of messages received, or < 0 on error.  Errors are:
+//	-E_INVAL if we have no mailbox or n is 0.
+// Destroys the environment if 'msgs' is not writable.
+static int
+sys_mbox_recv(struct Mboxmsg *msgs, unsigned n)
+{
+	struct Mboxmsg *slots;
+	unsigned i;
+
+	if (!curenv->env_mbox || n == 0)
+		return -E_INVAL;
+
+	if (curenv->env_mbox_count == 0) {
+		curenv->env_mbox_waiting = 1;
+		curenv->env_status = ENV_NOT_RUNNABLE;
+		return 0;
+	}
+
+	if (n > curenv->env_mbox_count)
+		n = curenv->env_mbox_count;
+	user_mem_assert(curenv, msgs, n * sizeof(*msgs), PTE_U | PTE_W);
+
+	slots = page2kva(curenv->env_mbox);
+	for (i = 0; i < n; i++) {
+		msgs[i] = slots[curenv->env_mbox_head];
+		curenv->env_mbox_head =
+			(curenv->env_mbox_head + 1) % curenv->env_mbox_nslots;
+	}
+	curenv->env_mbox_count -= n;
+	return n;
+}
+
+// Use the page at 'va' as the current environment's system call ring
+// (see inc/ring.h), replacing any previous one.  The kernel keeps a
+// reference to the page, so the ring stays valid even if 'va' is
+// later unmapped.  If 'va' >= UTOP, just drop the current ring.
+// The page must be mapped nowhere else, and from now on can't be
+// mapped anywhere else or made read-only (see page_map_source): the
+// kernel runs what is queued on it as the current environment.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if va < UTOP but va is not page-aligned, is not
+//		mapped writable in the current environment, or is
+//		mapped anywhere else too.
+static int
+sys_ring_setup(void *va)
+{
+	pte_t *pte;
+	struct Page *pp;
 
+	pp = NULL;
+	if ((uintptr_t) va < UTOP) {
+		if ((uintptr_t) va % PGSIZE)
+			return -E_INVAL;
+		pp = page_lookup(curenv->env_pgdir, va, &pte);
+		if (!pp || !(*pte & PTE_W)
+		    || pp->pp_ref != (pp == curenv->env_ring ? 2 : 1))
+			return -E_INVAL;
+		pp->pp_ref++;
+	}
+
+	if (curenv->env_ring)
+		page_decref(curenv->env_ring);
+	curenv->env_ring = pp;
 	return 0;
 }
 
+// Run the system calls queued on the current environment's ring, in
+// order, and post their results, until the submission queue is empty
+// or the completion queue is full.  This happens on sys_ring_enter and
+// on every other trap from the environment.
+//
+// Returns the number of system calls run.
+int
+ring_drain(void)
+{
+	struct Ring *r;
+	struct Ringsqe sqe;
+	uint32_t head;
+	int32_t res;
+	int n;
+
+	if (!curenv->env_ring)
+		return 0;
+
+	// The ring should be mapped at most once, by this environment,
+	// besides our own reference; if not, someone else could queue
+	// calls to be run as this environment, so leave it alone.
+	if (curenv->env_ring->pp_ref > 2)
+		return 0;
+
+	// The environment can scribble on the ring, so take a copy of
+	// each entry before looking at it.  The loop ends after at most
+	// RING_NSQE calls whatever the indices say.
+	r = page2kva(curenv->env_ring);
+	head = r->r_sq_head;
+	for (n = 0; n < RING_NSQE && head != r->r_sq_tail
+		     && r->r_cq_tail - r->r_cq_head < RING_NCQE; n++) {
+		sqe = r->r_sq[head % RING_NSQE];
+		switch (sqe.sqe_num) {
+		case SYS_page_alloc:
+		case SYS_page_map:
+		case SYS_page_unmap:
+		case SYS_ipc_try_send:
+		case SYS_mbox_send:
+			res = syscall(sqe.sqe_num, sqe.sqe_args[0],
+				      sqe.sqe_args[1], sqe.sqe_args[2],
+				      sqe.sqe_args[3], sqe.sqe_args[4], 0);
+			break;
+		default:
+			res = -E_INVAL;
+			break;
+		}
+
+		r->r_cq[r->r_cq_tail % RING_NCQE] =
+			(struct Ringcqe) { sqe.sqe_tag, res };
+		r->r_cq_tail++;
+		r->r_sq_head = ++head;
+	}
+	return n;
+}
+
+// Run the system calls queued on the current environment's ring.
+// See ring_drain.
+//
+// Returns the number of system calls run, or < 0 on error.  Errors are:
+//	-E_INVAL if the environment has no ring.
+static int
+sys_ring_enter(void)
+{
+	if (!curenv->env_ring)
+		return -E_INVAL;
+
+	return ring_drain();
+}
+
+// Become the driver for hardware interrupt 'irq' and unmask it
+// (see kern/irq.c).  The environment needs I/O privileges.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if irq is not a valid IRQ, or the kernel handles it.
+//	-E_BAD_ENV if we lack I/O privileges, or another environment
+//		drives irq.
+static int
+sys_irq_register(int irq)
+{
+	return irq_register(curenv, irq);
+}
+
+// Block until one of the IRQs we drive fires, and return its number.
+// Its IRQ stays masked until we call sys_irq_wait again, so call it
+// only after servicing the device.
+//
+// Returns the IRQ, or < 0 on error.  Errors are:
+//	-E_INVAL if we drive no IRQs.
+static int
+sys_irq_wait(void)
+{
+	return irq_wait(curenv);
+}
+
+// Return the physical address of the page mapped at 'va', so that we
+// can point a device's DMA at it.  Only environments with I/O
+// privileges, which can program devices, may ask.
+//
+// Returns the physical address, or < 0 on error.  Errors are:
+//	-E_INVAL if va >= UTOP, va is not page-aligned,
+//		or no page is mapped there.
+//	-E_BAD_ENV if we lack I/O privileges.
+static int
+sys_page_phys(void *va)
+{
+	int err;
+	struct Page *pp;
+
+	if ((curenv->env_tf.tf_eflags & FL_IOPL_MASK) != FL_IOPL_3)
+		return -E_BAD_ENV;
+
+	err = check_user_va((uintptr_t) va);
+	if (err)
+		return err;
+
+	if (!(pp = page_lookup(curenv->env_pgdir, va, 0)))
+		return -E_INVAL;
+	return page2pa(pp);
+}
+
+// Allocate an event object owned by the current environment.
+// It is freed by sys_event_free or when the environment exits.
+//
+// Returns the event's id, or < 0 on error.  Errors are:
+//	-E_NO_MEM if all event objects are in use.
+static int
+sys_event_alloc(void)
+{
+	return event_alloc(curenv);
+}
+
+// Free event object 'evid'.  Environments waiting for it are woken
+// with -E_INVAL.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if there is no such event, or it isn't ours.
+static int
+sys_event_free(int32_t evid)
+{
+	return event_free(curenv, evid);
+}
+
+// Signal event object 'evid'.  Signals don't count: the event stays
+// signaled until an environment's sys_wait_any sees it.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if there is no such event.
+static int
+sys_event_signal(int32_t evid)
+{
+	return event_signal(evid);
+}
+
+// Block until one of the 'n' things described in 'evs' happens,
+// or for at most 'timeout' clock ticks if 'timeout' is not negative
+// (0 just polls).  Each entry can wait for
+//	WAIT_IPC:   a message queued for us by sys_ipc_send, sys_ipc_call
+//	            or sys_mbox_send (which we then still have to receive);
+//	WAIT_ENV:   environment we_arg to exit, storing its exit status
+//	            in our env_wait_status (see sys_env_wait), or
+//	            -E_BAD_ENV if its slot was reused before we looked;
+//	WAIT_EVENT: event object we_arg to be signaled, which clears it.
+//
+// Returns the index in 'evs' of the first entry that happened, or < 0
+// on error.  Errors are:
+//	-E_TIMEOUT if nothing happened in time.
+//	-E_INVAL if n > WAIT_MAXEVENTS, an entry's type is unknown,
+//		or a WAIT_EVENT entry names no event (or it was freed
+//		while we waited).
+//	-E_INVAL if n is 0 and timeout is negative.
+// Destroys the environment if 'evs' is not readable.
+static int
+sys_wait_any(const struct Waitev *evs, unsigned n, int32_t timeout)
+{
+	unsigned i;
+
+	if (n > WAIT_MAXEVENTS || (n == 0 && timeout < 0))
+		return -E_INVAL;
+	user_mem_assert(curenv, evs, n * sizeof(*evs), PTE_U);
+
+	for (i = 0; i < n; i++) {
+		if (evs[i].we_type != WAIT_IPC && evs[i].we_type != WAIT_ENV
+		    && evs[i].we_type != WAIT_EVENT)
+			return -E_INVAL;
+		curenv->env_wait_evs[i] = evs[i];
+	}
+	curenv->env_wait_n = n;
+
+	return wait_any(curenv, timeout);
+}
 
 // Dispatches to the correct kernel function, passing the arguments.
+// The sixth argument, 'a6', comes from %ebp and is only used by system
+// calls that pass an IPC message in registers.
 uint32_t
-syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
+syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5, uint32_t a6)
 {
 	// Call the function corresponding to the 'syscallno' parameter.
 	// Return any appropriate return value.
@@ -552,9 +1464,23 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 		return sys_getenvid();
 	case SYS_env_destroy:
 		return sys_env_destroy(a1);
+	case SYS_env_exit:
+		sys_env_exit(a1);
+		return 0;
+	case SYS_env_wait:
+		return sys_env_wait(a1);
+	case SYS_irq_register:
+		return sys_irq_register(a1);
+	case SYS_irq_wait:
+		return sys_irq_wait();
+	case SYS_page_phys:
+		return sys_page_phys((void *) a1);
 	case SYS_yield:
 		sys_yield();
 		break;
+	case SYS_yield_to:
+		sys_yield_to(a1);
+		break;
 	case SYS_exofork:
 		return sys_exofork();
 	case SYS_env_set_status:
@@ -569,8 +1495,36 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 		return sys_env_set_pgfault_upcall(a1, (void *) a2);
 	case SYS_ipc_try_send:
 		return sys_ipc_try_send(a1, a2, (void *) a3, a4);
+	case SYS_ipc_send:
+		return sys_ipc_send(a1, a2, (void *) a3, a4, a5);
 	case SYS_ipc_recv:
-		return sys_ipc_recv((void *) a1);
+		return sys_ipc_recv((void *) a1, a2);
+	case SYS_ipc_call:
+		return sys_ipc_call(a1, a2, (void *) a3, a4, (void *) a5, a6);
+	case SYS_ipc_reply_wait:
+		return sys_ipc_reply_wait(a1, (void *) a2, a3, (void *) a4, a5, a6);
+	case SYS_ipc_callw:
+		return sys_ipc_callw(a1, a2, a3, a4, a5, a6);
+	case SYS_ipc_reply_waitw:
+		return sys_ipc_reply_waitw(a1, a2, a3, a4, a5);
+	case SYS_mbox_create:
+		return sys_mbox_create(a1, a2);
+	case SYS_mbox_send:
+		return sys_mbox_send(a1, a2);
+	case SYS_mbox_recv:
+		return sys_mbox_recv((struct Mboxmsg *) a1, a2);
+	case SYS_ring_setup:
+		return sys_ring_setup((void *) a1);
+	case SYS_ring_enter:
+		return sys_ring_enter();
+	case SYS_event_alloc:
+		return sys_event_alloc();
+	case SYS_event_free:
+		return sys_event_free(a1);
+	case SYS_event_signal:
+		return sys_event_signal(a1);
+	case SYS_wait_any:
+		return sys_wait_any((const struct Waitev *) a1, a2, a3);
 	case SYS_env_set_trapframe:
 		return sys_env_set_trapframe(a1, (struct Trapframe *) a2);
 	case SYS_env_get_trapframe:
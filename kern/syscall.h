@@ -6,6 +6,11 @@
 
 #include <inc/syscall.h>
 
-uint32_t syscall(uint32_t num, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5);
+struct Env;
+
+uint32_t syscall(uint32_t num, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5, uint32_t a6);
+int ring_drain(void);
+void cgetc_deliver(void);
+void cgetc_cancel(struct Env *e);
 
 #endif /* !JOS_KERN_SYSCALL_H */
@@ -1,6 +1,7 @@
 #include <inc/mmu.h>
 #include <inc/x86.h>
 #include <inc/assert.h>
+#include <inc/error.h>
 #include <inc/string.h>
 
 #include <kern/pmap.h>
@@ -13,8 +14,13 @@
 #include <kern/kclock.h>
 #include <kern/picirq.h>
 #include <kern/kdebug.h>
+#include <kern/fpu.h>
+#include <kern/event.h>
+#include <kern/irq.h>
 
-static struct Taskstate ts;
+// The TSS's esp0 points just past the running environment's env_tf
+// (see env_run), so traps from user mode build their frame in place.
+struct Taskstate ts;
 
 /* Interrupt descriptor table.  (Must be built at run time because
  * shifted function addresses can't be represented in relocation records.)
@@ -64,6 +70,7 @@ void
 idt_init(void)
 {
 	extern struct Segdesc gdt[];
+	uint32_t edx;
 	
 	// LAB 3: Your code here.
 	SETGATE(idt[T_DIVIDE], 0, GD_KT, trap_ex_divide, 0)
@@ -102,8 +109,13 @@ idt_init(void)
 	SETGATE(idt[IRQ_OFFSET+14], 0, GD_KT, int_nr_14, 0)
 	SETGATE(idt[IRQ_OFFSET+15], 0, GD_KT, int_nr_15, 0)
 
+	// _alltraps and sysenter_handler know these offsets.
+	static_assert(offsetof(struct Trapframe, tf_cs) == 0x34);
+	static_assert(offsetof(struct Taskstate, ts_esp0) == 4);
+
 	// Setup a TSS so that we get the right stack
-	// when we trap to the kernel.
+	// when we trap to the kernel.  Until an environment runs,
+	// that is the kernel stack.
 	ts.ts_esp0 = KSTACKTOP;
 	ts.ts_ss0 = GD_KD;
 
@@ -117,6 +129,16 @@ idt_init(void)
 
 	// Load the IDT
 	asm volatile("lidt idt_pd");
+
+	// Set up the SYSENTER entry point, if the CPU has one.
+	// SYSEXIT derives the user segments from SYSENTER_CS,
+	// which the GDT layout (GD_KT, GD_KD, GD_UT, GD_UD) allows.
+	cpuid(1, 0, 0, 0, &edx);
+	if (edx & CPUID_FEAT_SEP) {
+		wrmsr(MSR_IA32_SYSENTER_CS, GD_KT, 0);
+		wrmsr(MSR_IA32_SYSENTER_ESP, KSTACKTOP, 0);
+		wrmsr(MSR_IA32_SYSENTER_EIP, (uint32_t) sysenter_handler, 0);
+	}
 }
 
 void
@@ -163,7 +185,8 @@ trap_dispatch(struct Trapframe *tf)
  					  tf->tf_regs.reg_ecx,
  					  tf->tf_regs.reg_ebx,
  					  tf->tf_regs.reg_edi,
- 					  tf->tf_regs.reg_esi);
+ 					  tf->tf_regs.reg_esi,
+ 					  tf->tf_regs.reg_ebp);
  		return;
  	case T_DEBUG:
  		monitor_ss(tf);
@@ -171,25 +194,48 @@ trap_dispatch(struct Trapframe *tf)
  	case T_BRKPT:
  		monitor(tf);
  		return;
+ 	case T_DEVICE:
+ 		if ((tf->tf_cs & 3) == 3) {
+ 			fpu_trap(tf);
+ 			return;
+ 		}
+ 		break;
  	}
 
 	// Handle clock and serial interrupts.
 	// LAB 4: Your code here.
-	if (tf->tf_trapno == IRQ_OFFSET)
+	if (tf->tf_trapno == IRQ_OFFSET) {
+		cons_flush();
+		wait_tick();
 		sched_yield();
+	}
 
 	// Handle keyboard interrupts.
 	// LAB 5: Your code here.
 	if (tf->tf_trapno == IRQ_OFFSET + 1) {
 		kbd_intr();
+		cgetc_deliver();
 		return;
 	}
 
+	// Serial input comes in the same way.
+	if (tf->tf_trapno == IRQ_OFFSET + 4) {
+		serial_intr();
+		cgetc_deliver();
+		return;
+	}
+
+	// Other interrupts may belong to user-level drivers.
+	if (tf->tf_trapno >= IRQ_OFFSET && tf->tf_trapno < IRQ_OFFSET + MAX_IRQS
+	    && irq_deliver(tf->tf_trapno - IRQ_OFFSET))
+		return;
+
 	// Unexpected trap: The user process or the kernel has a bug.
 	print_trapframe(tf);
 	if (tf->tf_cs == GD_KT)
 		panic("unhandled trap in kernel");
 	else {
+		curenv->env_exit_status = -E_FAULT;
 		env_destroy(curenv);
 		return;
 	}
@@ -217,13 +263,16 @@ trap(struct Trapframe *tf)
 {
 	if ((tf->tf_cs & 3) == 3) {
 		// Trapped from user mode.
-		// Copy trap frame (which is currently on the stack)
-		// into 'curenv->env_tf', so that running the environment
+		// The trap frame was built right in 'curenv->env_tf'
+		// (see env_run and _alltraps), so running the environment
 		// will restart at the trap point.
-		assert(curenv);
-		curenv->env_tf = *tf;
-		// The trapframe on the stack should be ignored from here on.
-		tf = &curenv->env_tf;
+		assert(curenv && tf == &curenv->env_tf);
+
+		// Catch up on the environment's system call ring, unless
+		// this trap asks for exactly that.
+		if (curenv->env_ring && !(tf->tf_trapno == T_SYSCALL
+			&& tf->tf_regs.reg_eax == SYS_ring_enter))
+			ring_drain();
 	}
 	
 	// Dispatch based on what type of trap occurred
@@ -241,6 +290,41 @@ trap(struct Trapframe *tf)
 		sched_yield();
 }
 
+// Handle a system call made with SYSENTER.  'tf' is curenv's env_tf,
+// which sysenter_handler in kern/trapentry.S has filled in and
+// returns from with SYSEXIT if we return.  We only do that when the
+// environment can just carry on; otherwise we go the usual way.
+void
+sysenter_trap(struct Trapframe *tf)
+{
+	uint32_t eflags;
+
+	assert(curenv && tf == &curenv->env_tf);
+	eflags = tf->tf_eflags;
+
+	if (curenv->env_ring && tf->tf_regs.reg_eax != SYS_ring_enter)
+		ring_drain();
+
+	// The user's SI and BP hold its return address and stack,
+	// so there are only four arguments.
+	tf->tf_regs.reg_eax = syscall(tf->tf_regs.reg_eax,
+				      tf->tf_regs.reg_edx,
+				      tf->tf_regs.reg_ecx,
+				      tf->tf_regs.reg_ebx,
+				      tf->tf_regs.reg_edi,
+				      0, 0);
+
+	// If we made it to this point, then no other environment was
+	// scheduled.  Return through SYSEXIT unless the system call
+	// blocked us, or gave us new EFLAGS (sys_env_set_trapframe on
+	// ourselves, say): SYSEXIT leaves EFLAGS as they were on entry,
+	// so only iret can install those.
+	if (curenv->env_status != ENV_RUNNABLE)
+		sched_yield();
+	if (tf->tf_eflags != eflags)
+		env_run(curenv);
+}
+
 static void
 show_backtrace(uint32_t eip, uint32_t *ebp)
 {
@@ -391,5 +475,6 @@ page_fault_handler(struct Trapframe *tf)
 	cprintf("[%08x] user fault va %08x ip %08x\n",
 		curenv->env_id, fault_va, tf->tf_eip);
 	print_trapframe(tf);
+	curenv->env_exit_status = -E_FAULT;
 	env_destroy(curenv);
 }
@@ -12,6 +12,9 @@
 /* The kernel's interrupt descriptor table */
 extern struct Gatedesc idt[];
 
+/* The kernel's task state segment */
+extern struct Taskstate ts;
+
 void idt_init(void);
 void print_regs(struct PushRegs *regs);
 void print_trapframe(struct Trapframe *tf);
@@ -37,6 +40,7 @@ void trap_ex_align(void);
 void trap_ex_mcheck(void);
 void trap_ex_simderr(void);
 void trap_ex_syscall(void);
+void sysenter_handler(void);
 
 void int_nr_0(void);
 void int_nr_1(void);
@@ -85,8 +85,8 @@ cons_read(struct Fd *fd, void *vbuf, size_t n, off_t offset)
 	if (n == 0)
 		return 0;
 
-	while ((c = sys_cgetc()) == 0)
-		sys_yield();
+	// sys_cgetc blocks until a character is typed.
+	c = sys_cgetc();
 	if (c < 0)
 		return c;
 	if (c == 0x04)	// ctl-d is eof
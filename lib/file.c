@@ -24,6 +24,28 @@ struct Dev devfile =
 // Helper functions for file access
 static int fmap(struct Fd *fd, off_t oldsize, off_t newsize);
 static int funmap(struct Fd *fd, off_t oldsize, off_t newsize, bool dirty);
+static int stream_drop(off_t limit);
+
+// The first MAXFILESIZE bytes of an open file are mapped at fd2data.
+// On disks with FS_FEAT_DINDIRECT files can be larger; the rest of
+// them is reached through a window of STREAM_NPAGES pages at STREAMVA,
+// just past the file data areas (see lib/fd.c).  All of an
+// environment's open files share it, and file_read and file_write
+// slide it along the file as they go, so reading a big file straight
+// through takes one map request per window.
+#define STREAMVA	0xD8000000
+#define STREAM_NPAGES	256
+#define STREAM_SIZE	(STREAM_NPAGES * PGSIZE)
+
+static int stream_fileid = -1;	// file in the window, -1 if none
+static off_t stream_offset;	// file offset of STREAMVA
+
+// How much of a file 'size' bytes long is mapped at fd2data.
+static off_t
+fmapped(off_t size)
+{
+	return MIN(size, MAXFILESIZE);
+}
 
 // Open a file (or directory),
 // returning the file descriptor index on success, < 0 on failure.
@@ -52,7 +74,7 @@ open(const char *path, int mode)
 	if (r < 0)
 		goto out_err;
 
-	r = fmap(fd, 0, fd->fd_file.file.f_size);
+	r = fmap(fd, 0, fmapped(fd->fd_file.file.f_size));
 	if (r < 0)
 		goto out_err;
 
@@ -75,19 +97,121 @@ file_close(struct Fd *fd)
 	// (to free up its resources).
 
 	// LAB 5: Your code here.
-	r = funmap(fd, fd->fd_file.file.f_size, 0, 1);
+	r = funmap(fd, fmapped(fd->fd_file.file.f_size), 0, 1);
 	if (r < 0)
 		return r;
+	if (stream_fileid == fd->fd_file.id
+	    && (r = stream_drop(fd->fd_file.file.f_size)) < 0)
+		return r;
 
 	return fsipc_close(fd->fd_file.id);
 }
 
+// Make the stream window hold the page of file 'fd' containing
+// 'offset', which must be past MAXFILESIZE and inside the file.
+// Returns the address of 'offset', or 0 on error with '*r' set.
+static char *
+stream_map(struct Fd *fd, off_t offset, int *r)
+{
+	off_t i, end;
+	char *va;
+
+	if (stream_fileid != fd->fd_file.id || offset < stream_offset
+	    || offset >= stream_offset + STREAM_SIZE) {
+		if ((*r = stream_drop(0x7FFFFFFF)) < 0)
+			return 0;
+		stream_fileid = fd->fd_file.id;
+		stream_offset = ROUNDDOWN(offset, STREAM_SIZE);
+	}
+
+	va = (char *) STREAMVA + (offset - stream_offset);
+	if ((vpd[VPD(va)] & PTE_P) && (vpt[VPN(va)] & PTE_P))
+		return va;
+
+	// Map from here to the end of the window or of the file, in as
+	// few requests as the server allows.
+	end = MIN(stream_offset + STREAM_SIZE,
+		  ROUNDUP(fd->fd_file.file.f_size, PGSIZE));
+	for (i = ROUNDDOWN(offset, PGSIZE); i < end; i += *r * PGSIZE) {
+		*r = fsipc_map(fd->fd_file.id, i, (end - i) / PGSIZE,
+			       (char *) STREAMVA + (i - stream_offset));
+		if (*r == 0)
+			*r = -E_NO_DISK;
+		if (*r < 0) {
+			if (i > ROUNDDOWN(offset, PGSIZE))
+				break;
+			return 0;
+		}
+	}
+	return va;
+}
+
+// Unmap the stream window, telling the file server about the pages we
+// wrote to below file offset 'limit' (those past it are going away).
+static int
+stream_drop(off_t limit)
+{
+	size_t i;
+	off_t offset;
+	char *va;
+	int r, ret;
+
+	if (!(vpd[VPD(STREAMVA)] & PTE_P))
+		return 0;
+
+	ret = 0;
+	for (i = 0; i < STREAM_NPAGES; i++) {
+		va = (char *) STREAMVA + i * PGSIZE;
+		if (!(vpt[VPN(va)] & PTE_P))
+			continue;
+		offset = stream_offset + i * PGSIZE;
+		if (stream_fileid >= 0 && offset < limit
+		    && (vpt[VPN(va)] & PTE_D)
+		    && (r = fsipc_dirty(stream_fileid, offset)) < 0)
+			ret = r;
+		sys_page_unmap(0, va);
+	}
+	stream_fileid = -1;
+	return ret;
+}
+
+// Copy 'n' bytes between 'buf' and file 'fd' from 'offset' on, all of
+// which must be inside the file: into the file if 'write' is set, out
+// of it otherwise.  Returns 0 on success, < 0 on error.
+static int
+file_copy(struct Fd *fd, char *buf, size_t n, off_t offset, bool write)
+{
+	size_t m;
+	char *va;
+	int r;
+
+	while (n > 0) {
+		if (offset < MAXFILESIZE) {
+			va = fd2data(fd) + offset;
+			m = MIN(n, MAXFILESIZE - offset);
+		} else {
+			if (!(va = stream_map(fd, offset, &r)))
+				return r;
+			m = MIN(n, PGSIZE - offset % PGSIZE);
+		}
+		if (write)
+			memcpy(va, buf, m);
+		else
+			memcpy(buf, va, m);
+		buf += m;
+		offset += m;
+		n -= m;
+	}
+	return 0;
+}
+
 // Read 'n' bytes from 'fd' at the current seek position into 'buf'.
 // Since files are memory-mapped, this amounts to a memcpy()
 // surrounded by a little red tape to handle the file size and seek pointer.
 static ssize_t
 file_read(struct Fd *fd, void *buf, size_t n, off_t offset)
 {
+	int r;
 	size_t size;
 
 	// avoid reading past the end of file
@@ -98,7 +222,8 @@ file_read(struct Fd *fd, void *buf, size_t n, off_t offset)
 		n = size - offset;
 
 	// read the data by copying from the file mapping
-	memcpy(buf, fd2data(fd) + offset, n);
+	if ((r = file_copy(fd, buf, n, offset, 0)) < 0)
+		return r;
 	return n;
 }
 
@@ -124,6 +249,35 @@ read_map(int fdnum, off_t offset, void **blk)
 	return 0;
 }
 
+// Reserve disk space for the 'len' bytes of file 'fdnum' from
+// 'offset' on, in one contiguous run if possible, so that writing
+// them later keeps the file contiguous on disk.  Grows the file if
+// the range goes past its end; the new part reads as zeros.
+// Returns 0 on success, < 0 on failure.
+int
+fallocate(int fdnum, off_t offset, off_t len)
+{
+	int r, r2;
+	off_t oldsize;
+	struct Fd *fd;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id)
+		return -E_INVAL;
+	if ((fd->fd_omode & O_ACCMODE) == O_RDONLY)
+		return -E_INVAL;
+
+	oldsize = fd->fd_file.file.f_size;
+	r = fsipc_allocate(fd->fd_file.id, offset, len);
+	// Map whatever the file grew by, even if the server gave up
+	// partway.
+	if ((r2 = fmap(fd, fmapped(oldsize), fmapped(fd->fd_file.file.f_size))) < 0
+	    && r == 0)
+		r = r2;
+	return r;
+}
+
 // Write 'n' bytes from 'buf' to 'fd' at the current seek position.
 static ssize_t
 file_write(struct Fd *fd, const void *buf, size_t n, off_t offset)
@@ -131,9 +285,10 @@ file_write(struct Fd *fd, const void *buf, size_t n, off_t offset)
 	int r;
 	size_t tot;
 
-	// don't write past the maximum file size
+	// don't write past the maximum file size; the file server
+	// enforces the smaller limit of disks without FS_FEAT_DINDIRECT
 	tot = offset + n;
-	if (tot > MAXFILESIZE)
+	if (tot > MAXBIGFILESIZE || tot < offset)
 		return -E_NO_DISK;
 
 	// increase the file's size if necessary
@@ -143,7 +298,8 @@ file_write(struct Fd *fd, const void *buf, size_t n, off_t offset)
 	}
 
 	// write the data
-	memcpy(fd2data(fd) + offset, buf, n);
+	if ((r = file_copy(fd, (char *) buf, n, offset, 1)) < 0)
+		return r;
 	return n;
 }
 
@@ -164,7 +320,7 @@ file_trunc(struct Fd *fd, off_t newsize)
 	off_t oldsize;
 	uint32_t fileid;
 
-	if (newsize > MAXFILESIZE)
+	if (newsize > MAXBIGFILESIZE)
 		return -E_NO_DISK;
 
 	fileid = fd->fd_file.id;
@@ -173,15 +329,19 @@ file_trunc(struct Fd *fd, off_t newsize)
 		return r;
 	assert(fd->fd_file.file.f_size == newsize);
 
-	if ((r = fmap(fd, oldsize, newsize)) < 0)
+	if ((r = fmap(fd, fmapped(oldsize), fmapped(newsize))) < 0)
 		return r;
-	funmap(fd, oldsize, newsize, 0);
+	funmap(fd, fmapped(oldsize), fmapped(newsize), 0);
+	if (newsize < oldsize && stream_fileid == fileid)
+		stream_drop(newsize);
 
 	return 0;
 }
 
 // Call the file system server to obtain and map file pages
 // when the size of the file as mapped in our memory increases.
+// The whole range is asked for at once, so this usually takes a
+// single request.
 // Harmlessly does nothing if oldsize >= newsize.
 // Returns 0 on success, < 0 on error.
 // If there is an error, unmaps any newly allocated pages.
@@ -193,8 +353,12 @@ fmap(struct Fd* fd, off_t oldsize, off_t newsize)
 	int r;
 
 	va = fd2data(fd);
-	for (i = ROUNDUP(oldsize, PGSIZE); i < newsize; i += PGSIZE) {
-		if ((r = fsipc_map(fd->fd_file.id, i, va + i)) < 0) {
+	for (i = ROUNDUP(oldsize, PGSIZE); i < newsize; i += r * PGSIZE) {
+		r = fsipc_map(fd->fd_file.id, i,
+			      (ROUNDUP(newsize, PGSIZE) - i) / PGSIZE, va + i);
+		if (r == 0)
+			r = -E_NO_DISK;
+		if (r < 0) {
 			// unmap anything we may have mapped so far
 			funmap(fd, i, oldsize, 0);
 			return r;
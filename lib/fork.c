@@ -127,6 +127,7 @@ fork(void)
 	if (envid == 0) {
 		// Child
 		env = &envs[ENVX(sys_getenvid())];
+		envring = NULL;
 		return 0;
 	}
 
@@ -150,6 +151,10 @@ fork(void)
 			if ((pn * PGSIZE) == (UXSTACKTOP - PGSIZE))
 				continue;
 
+			// nor our system call ring
+			if ((void *) (pn * PGSIZE) == envring)
+				continue;
+
 			err = duppage(envid, pn);
 			if (err)
 				panic("duppage: %e", err);
@@ -218,6 +223,11 @@ sfork(void)
 			if ((pn * PGSIZE) == (UXSTACKTOP - PGSIZE))
 				continue;
 
+			// nor our system call ring, which the child can't
+			// use (it still sees it in envring, which is shared)
+			if ((void *) (pn * PGSIZE) == envring)
+				continue;
+
 			if ((pn * PGSIZE) == (USTACKTOP - PGSIZE)) {
 				err = duppage(envid, pn);
 				if (err)
@@ -5,23 +5,43 @@
 
 extern uint8_t fsipcbuf[PGSIZE];	// page-aligned, declared in entry.S
 
-// Send an IP request to the file server, and wait for a reply.
+// Send an IP request to the file server, and wait for a reply,
+// using a single ipc_call.
 // type: request code, passed as the simple integer IPC value.
 // fsreq: page to send containing additional request data, usually fsipcbuf.
 //	  Can be modified by server to return additional response info.
-// dstva: virtual address at which to receive reply page, 0 if none.
-// *perm: permissions of received page.
+// dstva: virtual address at which to receive reply pages, 0 if none.
+// npages: number of reply pages we can take at dstva.
+// *perm: permissions of received pages.
+// Returns 0 (or a count, for FSREQ_MAP) if successful, < 0 on failure.
+static int
+fsipc(unsigned type, void *fsreq, void *dstva, unsigned npages, int *perm)
+{
+	if (debug)
+		cprintf("[%08x] fsipc %d %08x\n", env->env_id, type, fsipcbuf);
+
+	return ipc_call(envs[1].env_id, type, fsreq, PTE_P | PTE_W | PTE_U,
+			dstva, npages, perm);
+}
+
+// Send a small request to the file server and wait for a reply, like
+// fsipc, but pass the request in the IPC's inline words rather than in
+// a page, so the server doesn't have to map and unmap one.
+// type: request code, passed as the simple integer IPC value.
+// fsreq, len: the request, at most IPC_NWORDS words long.
 // Returns 0 if successful, < 0 on failure.
 static int
-fsipc(unsigned type, void *fsreq, void *dstva, int *perm)
+fsipcw(unsigned type, const void *fsreq, size_t len)
 {
-	envid_t whom;
+	uint32_t words[IPC_NWORDS];
 
 	if (debug)
-		cprintf("[%08x] fsipc %d %08x\n", env->env_id, type, fsipcbuf);
+		cprintf("[%08x] fsipcw %d\n", env->env_id, type);
 
-	ipc_send(envs[1].env_id, type, fsreq, PTE_P | PTE_W | PTE_U);
-	return ipc_recv(&whom, dstva, perm);
+	assert(len <= sizeof(words));
+	memset(words, 0, sizeof(words));
+	memmove(words, fsreq, len);
+	return ipc_callw(envs[1].env_id, type, words, 0);
 }
 
 // Send file-open request to the file server.
@@ -41,15 +61,17 @@ fsipc_open(const char *path, int omode, struct Fd *fd)
 	strcpy(req->req_path, path);
 	req->req_omode = omode;
 
-	return fsipc(FSREQ_OPEN, req, fd, &perm);
+	return fsipc(FSREQ_OPEN, req, fd, 1, &perm);
 }
 
 // Make a map-block request to the file server.
-// We send the fileid and the (byte) offset of the desired block in the file,
-// and the server sends us back a mapping for a page containing that block.
-// Returns 0 on success, < 0 on failure.
+// We send the fileid, the (byte) offset of the first desired block in the
+// file and the number of blocks wanted, and the server sends us back
+// mappings for the pages containing those blocks, starting at 'dstva',
+// all in one message.  The server may send fewer blocks than asked for.
+// Returns the number of blocks mapped on success, < 0 on failure.
 int
-fsipc_map(int fileid, off_t offset, void *dstva)
+fsipc_map(int fileid, off_t offset, int npages, void *dstva)
 {
 	int r, perm;
 	struct Fsreq_map *req;
@@ -57,23 +79,25 @@ fsipc_map(int fileid, off_t offset, void *dstva)
 	req = (struct Fsreq_map*) fsipcbuf;
 	req->req_fileid = fileid;
 	req->req_offset = offset;
-	if ((r = fsipc(FSREQ_MAP, req, dstva, &perm)) < 0)
+	req->req_npages = npages;
+	if ((r = fsipc(FSREQ_MAP, req, dstva, npages, &perm)) < 0)
 		return r;
-	if ((perm & ~(PTE_W | PTE_SHARE)) != (PTE_U | PTE_P))
+	if (r > npages)
+		panic("fsipc_map: got %d blocks, asked for %d", r, npages);
+	if (r > 0 && (perm & ~(PTE_W | PTE_SHARE)) != (PTE_U | PTE_P))
 		panic("fsipc_map: unexpected permissions %08x for dstva %08x", perm, dstva);
-	return 0;
+	return r;
 }
 
 // Make a set-file-size request to the file server.
 int
 fsipc_set_size(int fileid, off_t size)
 {
-	struct Fsreq_set_size *req;
+	struct Fsreq_set_size req;
 
-	req = (struct Fsreq_set_size*) fsipcbuf;
-	req->req_fileid = fileid;
-	req->req_size = size;
-	return fsipc(FSREQ_SET_SIZE, req, 0, 0);
+	req.req_fileid = fileid;
+	req.req_size = size;
+	return fsipcw(FSREQ_SET_SIZE, &req, sizeof(req));
 }
 
 // Make a file-close request to the file server.
@@ -81,23 +105,34 @@ fsipc_set_size(int fileid, off_t size)
 int
 fsipc_close(int fileid)
 {
-	struct Fsreq_close *req;
+	struct Fsreq_close req;
 
-	req = (struct Fsreq_close*) fsipcbuf;
-	req->req_fileid = fileid;
-	return fsipc(FSREQ_CLOSE, req, 0, 0);
+	req.req_fileid = fileid;
+	return fsipcw(FSREQ_CLOSE, &req, sizeof(req));
 }
 
 // Ask the file server to mark a particular file block dirty.
 int
 fsipc_dirty(int fileid, off_t offset)
 {
-	struct Fsreq_dirty *req;
+	struct Fsreq_dirty req;
 
-	req = (struct Fsreq_dirty*) fsipcbuf;
-	req->req_fileid = fileid;
-	req->req_offset = offset;
-	return fsipc(FSREQ_DIRTY, req, 0, 0);
+	req.req_fileid = fileid;
+	req.req_offset = offset;
+	return fsipcw(FSREQ_DIRTY, &req, sizeof(req));
+}
+
+// Ask the file server to give an open file contiguous disk blocks for
+// the 'len' bytes from 'offset' on, growing it if need be.
+int
+fsipc_allocate(int fileid, off_t offset, off_t len)
+{
+	struct Fsreq_allocate req;
+
+	req.req_fileid = fileid;
+	req.req_offset = offset;
+	req.req_len = len;
+	return fsipcw(FSREQ_ALLOCATE, &req, sizeof(req));
 }
 
 // Ask the file server to delete a file, given its pathname.
@@ -110,7 +145,7 @@ fsipc_remove(const char *path)
 	if (strlen(path) >= MAXPATHLEN)
 		return -E_BAD_PATH;
 	strcpy(req->req_path, path);
-	return fsipc(FSREQ_REMOVE, req, 0, 0);
+	return fsipc(FSREQ_REMOVE, req, 0, 0, 0);
 }
 
 // Ask the file server to update the disk
@@ -118,6 +153,19 @@ fsipc_remove(const char *path)
 int
 fsipc_sync(void)
 {
-	return fsipc(FSREQ_SYNC, fsipcbuf, 0, 0);
+	return fsipcw(FSREQ_SYNC, 0, 0);
 }
 
+// Fetch the file server's buffer cache counters into *st.
+int
+fsipc_stats(struct Fsstats *st)
+{
+	uint32_t words[IPC_NWORDS];
+	int r;
+
+	static_assert(sizeof(*st) <= sizeof(words));
+	if ((r = ipc_callw(envs[1].env_id, FSREQ_STATS, 0, words)) < 0)
+		return r;
+	memmove(st, words, sizeof(*st));
+	return r;
+}
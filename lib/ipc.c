@@ -16,18 +16,30 @@
 //   as meaning "no page".  (Zero is not the right value.)
 uint32_t
 ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
+{
+	// LAB 4: Your code here.
+	return ipc_recv_pages(from_env_store, pg, 1, perm_store, 0);
+}
+
+// Like ipc_recv, but accept up to 'npages' contiguous pages starting
+// at 'pg'.  If 'npages_store' is nonnull, store the number of pages
+// actually transferred in *npages_store (0 on error).
+uint32_t
+ipc_recv_pages(envid_t *from_env_store, void *pg, unsigned npages,
+	       int *perm_store, unsigned *npages_store)
 {
 	int err;
 
-	// LAB 4: Your code here.
 	if (!pg)
 		pg = (void *) UTOP;
 	if (from_env_store)
 		*from_env_store = 0;
 	if (perm_store)
 		*perm_store = 0;
+	if (npages_store)
+		*npages_store = 0;
 
-	err = sys_ipc_recv(pg);
+	err = sys_ipc_recv(pg, npages);
 	if (err)
 		return err;
 
@@ -38,31 +50,182 @@ ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
 		*from_env_store = envs[ENVX(sys_getenvid())].env_ipc_from;
 	if (perm_store)
 		*perm_store = envs[ENVX(sys_getenvid())].env_ipc_perm;
+	if (npages_store)
+		*npages_store = envs[ENVX(sys_getenvid())].env_ipc_npages;
 
 	return envs[ENVX(sys_getenvid())].env_ipc_value;
 }
 
 // Send 'val' (and 'pg' with 'perm', assuming 'pg' is nonnull) to 'toenv'.
-// This function keeps trying until it succeeds.
-// It should panic() on any error other than -E_IPC_NOT_RECV.
-//
-// Hint:
-//   Use sys_yield() to be CPU-friendly.
-//   If 'pg' is null, pass sys_ipc_recv a value that it will understand
-//   as meaning "no page".  (Zero is not the right value.)
+// This function blocks in the kernel until 'toenv' receives the message;
+// concurrent senders are queued and served in FIFO order.
+// It should panic() on any error.
 void
 ipc_send(envid_t to_env, uint32_t val, void *pg, int perm)
+{
+	ipc_send_pages(to_env, val, pg, 1, perm);
+}
+
+// Like ipc_send, but grant the 'npages' contiguous pages starting at
+// 'pg' in one message.  The receiver gets as many of them as fit in
+// the window it passed to ipc_recv_pages.
+void
+ipc_send_pages(envid_t to_env, uint32_t val, void *pg, unsigned npages,
+	       int perm)
 {
 	int err;
 
-	// LAB 4: Your code here.
-	for (; ; ) {
-		err = sys_ipc_try_send(to_env, val, pg, perm);
-		if (!err || err == 1)
-			return;
-		if (err != -E_IPC_NOT_RECV)
-			panic("sys_ipc_try_send(): %e\n", err);
-		sys_yield();
-	}
+	err = sys_ipc_send(to_env, val, pg, perm, npages);
+	if (err < 0)
+		panic("sys_ipc_send(): %e\n", err);
 }
 
+// Send 'val' (and 'pg' with 'perm', assuming 'pg' is nonnull) to the
+// server 'to_env' and wait for its reply, in a single system call.
+// 'rcv_pg', 'rcv_npages' and 'perm_store' work as the 'pg', 'npages'
+// and 'perm_store' arguments of ipc_recv_pages, for the reply.
+// Returns the reply value, or the error if the call failed.
+uint32_t
+ipc_call(envid_t to_env, uint32_t val, void *pg, int perm,
+	 void *rcv_pg, unsigned rcv_npages, int *perm_store)
+{
+	int r;
+
+	if (!rcv_pg)
+		rcv_pg = (void *) UTOP;
+	if (perm_store)
+		*perm_store = 0;
+
+	r = sys_ipc_call(to_env, val, pg, perm, rcv_pg, rcv_npages);
+	if (r < 0)
+		return r;
+
+	if (perm_store)
+		*perm_store = envs[ENVX(sys_getenvid())].env_ipc_perm;
+
+	return r;
+}
+
+// Reply 'val' (and the 'npages' pages at 'pg' with 'perm', assuming
+// 'pg' is nonnull) to the environment whose ipc_call we received last,
+// then receive the next message as ipc_recv does, in a single system
+// call.
+// The arguments after 'perm' and the return value are as for ipc_recv;
+// if 'words_store' is nonnull, the message's IPC_NWORDS inline words
+// are stored there.
+uint32_t
+ipc_reply_wait(uint32_t val, void *pg, unsigned npages, int perm,
+	       envid_t *from_env_store, void *rcv_pg, int *perm_store,
+	       uint32_t *words_store)
+{
+	int err;
+	const volatile struct Env *e;
+
+	if (!rcv_pg)
+		rcv_pg = (void *) UTOP;
+	if (from_env_store)
+		*from_env_store = 0;
+	if (perm_store)
+		*perm_store = 0;
+
+	err = sys_ipc_reply_wait(val, pg, perm, rcv_pg, npages, 1);
+	if (err)
+		return err;
+
+	e = &envs[ENVX(sys_getenvid())];
+	if (from_env_store)
+		*from_env_store = e->env_ipc_from;
+	if (perm_store)
+		*perm_store = e->env_ipc_perm;
+	if (words_store)
+		memmove(words_store, (const void *) e->env_ipc_words,
+			sizeof(e->env_ipc_words));
+
+	return e->env_ipc_value;
+}
+
+// Like ipc_call, but the request is 'val' plus the IPC_NWORDS inline
+// 'words' (zeros if 'words' is null), all carried in registers, and
+// neither the request nor the reply includes a page.
+// The reply's inline words are stored in 'words_store' if nonnull.
+uint32_t
+ipc_callw(envid_t to_env, uint32_t val, const uint32_t *words,
+	  uint32_t *words_store)
+{
+	static const uint32_t zero[IPC_NWORDS];
+	int r;
+
+	r = sys_ipc_callw(to_env, val, words ? words : zero);
+	if (r < 0)
+		return r;
+
+	if (words_store)
+		memmove(words_store,
+			(const void *) envs[ENVX(sys_getenvid())].env_ipc_words,
+			sizeof(envs[0].env_ipc_words));
+
+	return r;
+}
+
+// Like ipc_reply_wait, but the reply is 'val' plus the IPC_NWORDS
+// inline 'words' (zeros if 'words' is null) and carries no page.
+// The next message is received into the same page as the last one
+// (none if that was null), since there's no register left for it.
+uint32_t
+ipc_reply_waitw(uint32_t val, const uint32_t *words,
+		envid_t *from_env_store, int *perm_store,
+		uint32_t *words_store)
+{
+	static const uint32_t zero[IPC_NWORDS];
+	int err;
+	const volatile struct Env *e;
+
+	if (from_env_store)
+		*from_env_store = 0;
+	if (perm_store)
+		*perm_store = 0;
+
+	err = sys_ipc_reply_waitw(val, words ? words : zero);
+	if (err)
+		return err;
+
+	e = &envs[ENVX(sys_getenvid())];
+	if (from_env_store)
+		*from_env_store = e->env_ipc_from;
+	if (perm_store)
+		*perm_store = e->env_ipc_perm;
+	if (words_store)
+		memmove(words_store, (const void *) e->env_ipc_words,
+			sizeof(e->env_ipc_words));
+
+	return e->env_ipc_value;
+}
+
+// Queue 'val' in the mailbox of 'to_env' without waiting for it to be
+// received.  If the mailbox is full, yield to 'to_env' so it can drain
+// it, and try again.
+// It should panic() on any other error.
+void
+mbox_send(envid_t to_env, uint32_t val)
+{
+	int err;
+
+	while ((err = sys_mbox_send(to_env, val)) == -E_MBOX_FULL)
+		sys_yield_to(to_env);
+	if (err < 0)
+		panic("sys_mbox_send(): %e\n", err);
+}
+
+// Receive up to 'n' messages from our mailbox into 'msgs', blocking
+// until at least one is available.
+// Returns the number of messages received, or < 0 on error.
+int
+mbox_recv(struct Mboxmsg *msgs, unsigned n)
+{
+	int r;
+
+	// 0 means a send woke us up; the messages are waiting now.
+	while ((r = sys_mbox_recv(msgs, n)) == 0)
+		;
+	return r;
+}
@@ -19,9 +19,20 @@ struct Dev devpipe =
 
 #define PIPEBUFSIZ 32		// small to provoke races
 
+// An end that finds the pipe empty (or full) sets p_rwait (or p_wwait)
+// and waits for event p_rev (or p_wev), which the other end signals
+// after writing (or reading) and when it closes.  The wait times out
+// after PIPE_TIMEOUT clock ticks, in case the other end died without
+// closing.
+#define PIPE_TIMEOUT 10
+
 struct Pipe {
 	off_t p_rpos;		// read position
 	off_t p_wpos;		// write position
+	int p_rev;		// event signaled for readers, or 0
+	int p_wev;		// event signaled for writers, or 0
+	bool p_rwait;		// a reader is waiting for p_rev
+	bool p_wwait;		// a writer is waiting for p_wev
 	uint8_t p_buf[PIPEBUFSIZ];	// data buffer
 };
 
@@ -30,6 +41,7 @@ pipe(int pfd[2])
 {
 	int r;
 	struct Fd *fd0, *fd1;
+	struct Pipe *p;
 	void *va;
 
 	// allocate the file descriptor table entries
@@ -48,6 +60,14 @@ pipe(int pfd[2])
 	if ((r = sys_page_map(0, va, 0, fd2data(fd1), PTE_P|PTE_W|PTE_U|PTE_SHARE)) < 0)
 		goto err3;
 
+	// The events are ours, so they last as long as we do.
+	// Without them the ends just yield while they wait.
+	p = (struct Pipe *) va;
+	if ((p->p_rev = sys_event_alloc()) < 0)
+		p->p_rev = 0;
+	if ((p->p_wev = sys_event_alloc()) < 0)
+		p->p_wev = 0;
+
 	// set up fd structures
 	fd0->fd_dev_id = devpipe.dev_id;
 	fd0->fd_omode = O_RDONLY;
@@ -119,6 +139,28 @@ pipeisclosed(int fdnum)
 	return _pipeisclosed(fd, p);
 }
 
+// Wait for pipe event 'evid', which the other end signals
+// when it changes the pipe if '*waiting' is set.
+static void
+pipe_wait(int evid, bool *waiting)
+{
+	struct Waitev we = { WAIT_EVENT, evid };
+
+	if (!evid || sys_wait_any(&we, 1, PIPE_TIMEOUT) == -E_INVAL)
+		sys_yield();
+	*waiting = 0;
+}
+
+// Tell the other end of pipe 'p' that it changed, if it is waiting.
+static void
+pipe_wake(int evid, bool *waiting)
+{
+	if (*waiting && evid) {
+		*waiting = 0;
+		sys_event_signal(evid);
+	}
+}
+
 static int
 pipe_is_empty(const struct Pipe *p)
 {
@@ -149,18 +191,23 @@ piperead(struct Fd *fd, void *vbuf, size_t n, off_t offset)
 
 	for (i = 0; i < n; i++) {
 		while (pipe_is_empty(p)) {
-			if (_pipeisclosed(fd, p) && !i)
+			if (i)
+				goto out;
+			// Say we are waiting before the last look,
+			// so that a write after it will signal us.
+			p->p_rwait = 1;
+			if (_pipeisclosed(fd, p))
 				return 0;
-			if (!i)
-				sys_yield();
-			else
-				return i;
+			if (pipe_is_empty(p))
+				pipe_wait(p->p_rev, &p->p_rwait);
 		}
 		buf[i] = p->p_buf[p->p_rpos];
 		p->p_rpos = (p->p_rpos + 1) % PIPEBUFSIZ;
 	}
 
-	return n;
+out:
+	pipe_wake(p->p_wev, &p->p_wwait);
+	return i;
 }
 
 static int
@@ -191,14 +238,18 @@ pipewrite(struct Fd *fd, const void *vbuf, size_t n, off_t offset)
 
 	for (i = 0; i < n; i++) {
 		while (pipe_is_full(p)) {
+			pipe_wake(p->p_rev, &p->p_rwait);
+			p->p_wwait = 1;
 			if (_pipeisclosed(fd, p))
 				return 0;
-			sys_yield();
+			if (pipe_is_full(p))
+				pipe_wait(p->p_wev, &p->p_wwait);
 		}
 		p->p_buf[p->p_wpos] = buf[i];
 		p->p_wpos = (p->p_wpos + 1) % PIPEBUFSIZ;
 	}
 
+	pipe_wake(p->p_rev, &p->p_rwait);
 	return n;
 }
 
@@ -216,12 +267,26 @@ pipestat(struct Fd *fd, struct Stat *stat)
 static int
 pipeclose(struct Fd *fd)
 {
-	int err;
+	int err, rev, wev;
+	struct Pipe *p;
+
+	// Wake the other end once we are gone, so that it sees
+	// the pipe closed.
+	p = (struct Pipe *) fd2data(fd);
+	rev = p->p_rev;
+	wev = p->p_wev;
 
 	err = sys_page_unmap(0, fd);
+	if (err)
+		return err;
+	err = sys_page_unmap(0, p);
 	if (err)
 		return err;
 
-	return sys_page_unmap(0, fd2data(fd));
+	if (rev)
+		sys_event_signal(rev);
+	if (wev)
+		sys_event_signal(wev);
+	return 0;
 }
 
@@ -35,6 +35,8 @@ static const char * const error_string[MAXERROR + 1] =
 	"invalid path",
 	"file already exists",
 	"file is not a valid executable",
+	"mailbox is full",
+	"timed out",
 };
 
 /*
@@ -0,0 +1,50 @@
+// System call rings (see inc/ring.h).
+
+#include <inc/lib.h>
+
+// This environment's system call ring, or null.  The kernel won't let
+// the page be mapped in any other environment, so fork leaves it out,
+// and a child has to set up a ring of its own.
+struct Ring *envring;
+
+// Allocate a fresh page at 'r' and make it this environment's
+// system call ring.
+int
+ring_setup(struct Ring *r)
+{
+	int i;
+
+	if ((i = sys_page_alloc(0, r, PTE_P|PTE_U|PTE_W)) < 0)
+		return i;
+	if ((i = sys_ring_setup(r)) < 0) {
+		sys_page_unmap(0, r);
+		return i;
+	}
+	envring = r;
+	return 0;
+}
+
+// Queue the system call '*sqe' on 'r'.  It runs at the next
+// sys_ring_enter, or sooner if we trap into the kernel first.
+// Returns -E_NO_MEM if the submission queue is full.
+int
+ring_submit(struct Ring *r, const struct Ringsqe *sqe)
+{
+	if (r->r_sq_tail - r->r_sq_head == RING_NSQE)
+		return -E_NO_MEM;
+	r->r_sq[r->r_sq_tail % RING_NSQE] = *sqe;
+	r->r_sq_tail++;
+	return 0;
+}
+
+// Take the oldest completion off 'r' into '*cqe'.
+// Returns 1 if there was one, 0 if the completion queue is empty.
+int
+ring_complete(struct Ring *r, struct Ringcqe *cqe)
+{
+	if (r->r_cq_head == r->r_cq_tail)
+		return 0;
+	*cqe = r->r_cq[r->r_cq_head % RING_NCQE];
+	r->r_cq_head++;
+	return 1;
+}
@@ -2,12 +2,59 @@
 
 #include <inc/syscall.h>
 #include <inc/lib.h>
+#include <inc/x86.h>
+
+// Can we enter the kernel with SYSENTER?  The kernel sets it up
+// whenever the CPU supports it.
+static int
+have_sysenter(void)
+{
+	static int have = -1;
+	uint32_t edx;
+
+	if (have < 0) {
+		cpuid(1, 0, 0, 0, &edx);
+		have = (edx & CPUID_FEAT_SEP) != 0;
+	}
+	return have;
+}
+
+static inline uint32_t
+fast_syscall(int num, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4)
+{
+	uint32_t ret;
+
+	// System call through SYSENTER: number in AX, up to four
+	// parameters in DX, CX, BX, DI.  SYSENTER saves nothing,
+	// so pass the return address in SI and the stack pointer
+	// in BP (saved on the stack first).  SYSEXIT comes back
+	// with DX and CX clobbered.
+
+	asm volatile("pushl %%ebp\n\t"
+		     "movl %%esp, %%ebp\n\t"
+		     "leal 1f, %%esi\n\t"
+		     "sysenter\n"
+		     "1:\tpopl %%ebp\n"
+		: "=a" (ret),
+		  "+d" (a1),
+		  "+c" (a2)
+		: "a" (num),
+		  "b" (a3),
+		  "D" (a4)
+		: "esi", "cc", "memory");
+
+	return ret;
+}
 
 static inline uint32_t
 syscall(int num, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
 {
 	uint32_t ret;
 
+	// Calls that fit take the faster SYSENTER path.
+	if (a5 == 0 && have_sysenter())
+		return fast_syscall(num, a1, a2, a3, a4);
+
 	// Generic system call: pass system call number in AX,
 	// up to five parameters in DX, CX, BX, DI, SI.
 	// Interrupt kernel with T_SYSCALL.
@@ -34,6 +81,38 @@ syscall(int num, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5
 	return ret;
 }
 
+static inline uint32_t
+syscall6(int num, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5, uint32_t a6)
+{
+	uint32_t ret;
+
+	// Like syscall, but with a sixth parameter in BP, which can't
+	// be named as an asm operand.  Stage it in AX, and the system
+	// call number on the stack: every register is taken, and an
+	// operand in memory may be addressed off BP or SP, so it has to
+	// be pushed before either changes.
+
+	asm volatile("pushl %2\n\t"
+		     "pushl %%ebp\n\t"
+		     "movl %%eax, %%ebp\n\t"
+		     "movl 4(%%esp), %%eax\n\t"
+		     "int %1\n\t"
+		     "popl %%ebp\n\t"
+		     "addl $4, %%esp\n"
+		: "=a" (ret)
+		: "i" (T_SYSCALL),
+		  "g" (num),
+		  "d" (a1),
+		  "c" (a2),
+		  "b" (a3),
+		  "D" (a4),
+		  "S" (a5),
+		  "a" (a6)
+		: "cc", "memory");
+
+	return ret;
+}
+
 void
 sys_cputs(const char *s, size_t len)
 {
@@ -52,6 +131,19 @@ sys_env_destroy(envid_t envid)
 	return syscall(SYS_env_destroy, envid, 0, 0, 0, 0);
 }
 
+void
+sys_env_exit(int status)
+{
+	syscall(SYS_env_exit, status, 0, 0, 0, 0);
+	panic("sys_env_exit returned");
+}
+
+int
+sys_env_wait(envid_t envid)
+{
+	return syscall(SYS_env_wait, envid, 0, 0, 0, 0);
+}
+
 envid_t
 sys_getenvid(void)
 {
@@ -64,6 +156,12 @@ sys_yield(void)
 	syscall(SYS_yield, 0, 0, 0, 0, 0);
 }
 
+void
+sys_yield_to(envid_t envid)
+{
+	syscall(SYS_yield_to, envid, 0, 0, 0, 0);
+}
+
 int
 sys_page_alloc(envid_t envid, void *va, int perm)
 {
@@ -115,8 +213,109 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, int perm)
 }
 
 int
-sys_ipc_recv(void *dstva)
+sys_ipc_send(envid_t envid, uint32_t value, void *srcva, int perm, unsigned npages)
+{
+	return syscall(SYS_ipc_send, envid, value, (uint32_t) srcva, perm, npages);
+}
+
+int
+sys_ipc_recv(void *dstva, unsigned npages)
+{
+	return syscall(SYS_ipc_recv, (uint32_t) dstva, npages, 0, 0, 0);
+}
+
+int
+sys_ipc_call(envid_t envid, uint32_t value, void *srcva, int perm, void *dstva, unsigned dstnpages)
+{
+	return syscall6(SYS_ipc_call, envid, value, (uint32_t) srcva, perm, (uint32_t) dstva, dstnpages);
+}
+
+int
+sys_ipc_reply_wait(uint32_t value, void *srcva, int perm, void *dstva, unsigned npages, unsigned dstnpages)
 {
-	return syscall(SYS_ipc_recv, (uint32_t) dstva, 0, 0, 0, 0);
+	return syscall6(SYS_ipc_reply_wait, value, (uint32_t) srcva, perm, (uint32_t) dstva, npages, dstnpages);
 }
 
+int
+sys_ipc_callw(envid_t envid, uint32_t value, const uint32_t *words)
+{
+	return syscall6(SYS_ipc_callw, envid, value, words[0], words[1], words[2], words[3]);
+}
+
+int
+sys_ipc_reply_waitw(uint32_t value, const uint32_t *words)
+{
+	return syscall(SYS_ipc_reply_waitw, value, words[0], words[1], words[2], words[3]);
+}
+
+int
+sys_mbox_create(envid_t envid, unsigned nslots)
+{
+	return syscall(SYS_mbox_create, envid, nslots, 0, 0, 0);
+}
+
+int
+sys_mbox_send(envid_t envid, uint32_t value)
+{
+	return syscall(SYS_mbox_send, envid, value, 0, 0, 0);
+}
+
+int
+sys_mbox_recv(struct Mboxmsg *msgs, unsigned n)
+{
+	return syscall(SYS_mbox_recv, (uint32_t) msgs, n, 0, 0, 0);
+}
+
+int
+sys_ring_setup(void *va)
+{
+	return syscall(SYS_ring_setup, (uint32_t) va, 0, 0, 0, 0);
+}
+
+int
+sys_ring_enter(void)
+{
+	return syscall(SYS_ring_enter, 0, 0, 0, 0, 0);
+}
+
+int
+sys_event_alloc(void)
+{
+	return syscall(SYS_event_alloc, 0, 0, 0, 0, 0);
+}
+
+int
+sys_event_free(int evid)
+{
+	return syscall(SYS_event_free, evid, 0, 0, 0, 0);
+}
+
+int
+sys_event_signal(int evid)
+{
+	return syscall(SYS_event_signal, evid, 0, 0, 0, 0);
+}
+
+int
+sys_wait_any(const struct Waitev *evs, unsigned n, int timeout)
+{
+	return syscall(SYS_wait_any, (uint32_t) evs, n, timeout, 0, 0);
+}
+
+int
+sys_irq_register(int irq)
+{
+	return syscall(SYS_irq_register, irq, 0, 0, 0, 0);
+}
+
+int
+sys_irq_wait(void)
+{
+	return syscall(SYS_irq_wait, 0, 0, 0, 0, 0);
+}
+
+int
+sys_page_phys(void *va)
+{
+	return syscall(SYS_page_phys, (uint32_t) va, 0, 0, 0, 0);
+}
@@ -1,13 +1,15 @@
 #include <inc/lib.h>
 
-// Waits until 'envid' exits.
-void
+// Waits until 'envid' exits.  Returns its exit status (see exit_status;
+// it is -E_FAULT if the environment died of a fault), or -E_BAD_ENV
+// if 'envid' exited too long ago to know.
+int
 wait(envid_t envid)
 {
-	volatile struct Env *e;
+	int r;
 
 	assert(envid != 0);
-	e = &envs[ENVX(envid)];
-	while (e->env_id == envid && e->env_status != ENV_FREE)
-		sys_yield();
+	if ((r = sys_env_wait(envid)) < 0)
+		return r;
+	return env->env_wait_status;
 }
@@ -0,0 +1,14 @@
+#include <inc/lib.h>
+
+// Print the file server's buffer cache counters.
+void
+umain(int argc, char **argv)
+{
+	int r;
+	struct Fsstats st;
+
+	if ((r = fsipc_stats(&st)) < 0)
+		panic("fsipc_stats: %e", r);
+	printf("hits %u misses %u evictions %u writebacks %u\n",
+	       st.st_hits, st.st_misses, st.st_evictions, st.st_writebacks);
+}
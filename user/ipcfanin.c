@@ -0,0 +1,36 @@
+// IPC fan-in benchmark.
+// NCLIENT children each send NMSG values to their parent,
+// which receives them all and reports how many cycles it took.
+
+#include <inc/x86.h>
+#include <inc/lib.h>
+
+#define NCLIENT	8
+#define NMSG	1000
+
+void
+umain(void)
+{
+	int i, r;
+	envid_t server, who;
+	uint64_t start, cycles;
+
+	server = sys_getenvid();
+	for (i = 0; i < NCLIENT; i++) {
+		if ((r = fork()) < 0)
+			panic("fork: %e", r);
+		if (r == 0) {
+			for (i = 0; i < NMSG; i++)
+				ipc_send(server, i, 0, 0);
+			return;
+		}
+	}
+
+	start = read_tsc();
+	for (i = 0; i < NCLIENT * NMSG; i++)
+		ipc_recv(&who, 0, 0);
+	cycles = read_tsc() - start;
+
+	cprintf("ipcfanin: %d clients, %d messages: %llu cycles, %llu per message\n",
+		NCLIENT, NCLIENT * NMSG, cycles, cycles / (NCLIENT * NMSG));
+}
@@ -0,0 +1,66 @@
+// Big directory test and benchmark.
+// Creates NFILES files in the root directory, which is enough for it
+// to get a hashed index, opens each of them again, reporting the
+// cycles the opens took, and removes them, checking that each step
+// sees exactly the files it should.
+
+#include <inc/x86.h>
+#include <inc/lib.h>
+
+#define NFILES		400
+
+static void
+name(char *buf, int i)
+{
+	snprintf(buf, MAXNAMELEN, "/many%d", i);
+}
+
+void
+umain(void)
+{
+	char path[MAXNAMELEN];
+	int fd, i, r;
+	uint64_t start, cycles;
+
+	for (i = 0; i < NFILES; i++) {
+		name(path, i);
+		if ((fd = open(path, O_WRONLY | O_CREAT)) < 0)
+			panic("create %s: %e", path, fd);
+		close(fd);
+	}
+
+	start = read_tsc();
+	for (i = 0; i < NFILES; i++) {
+		name(path, i);
+		if ((fd = open(path, O_RDONLY)) < 0)
+			panic("open %s: %e", path, fd);
+		close(fd);
+	}
+	cycles = read_tsc() - start;
+	cprintf("manyfiles: %d opens in %llu cycles, %llu cycles/open\n",
+		NFILES, cycles, cycles / NFILES);
+
+	// Remove every other file, and check that the rest are still
+	// there and the removed ones gone.
+	for (i = 0; i < NFILES; i += 2) {
+		name(path, i);
+		if ((r = remove(path)) < 0)
+			panic("remove %s: %e", path, r);
+	}
+	for (i = 0; i < NFILES; i++) {
+		name(path, i);
+		fd = open(path, O_RDONLY);
+		if (i % 2 == 0 && fd != -E_NOT_FOUND)
+			panic("open removed %s: got %e", path, fd);
+		if (i % 2 == 1 && fd < 0)
+			panic("open %s: %e", path, fd);
+		if (fd >= 0)
+			close(fd);
+	}
+	for (i = 1; i < NFILES; i += 2) {
+		name(path, i);
+		if ((r = remove(path)) < 0)
+			panic("remove %s: %e", path, r);
+	}
+	cprintf("manyfiles: OK\n");
+}
@@ -0,0 +1,48 @@
+// Null system call latency benchmark.
+// Times NCALL sys_getenvid calls through 'int $T_SYSCALL'
+// and through SYSENTER, and reports the cycles per call.
+
+#include <inc/x86.h>
+#include <inc/lib.h>
+
+#define NCALL	100000
+
+static envid_t
+int_getenvid(void)
+{
+	envid_t ret;
+
+	asm volatile("int %1\n"
+		: "=a" (ret)
+		: "i" (T_SYSCALL),
+		  "a" (SYS_getenvid)
+		: "cc", "memory");
+	return ret;
+}
+
+void
+umain(void)
+{
+	int i;
+	uint32_t edx;
+	uint64_t start, cycles;
+
+	start = read_tsc();
+	for (i = 0; i < NCALL; i++)
+		int_getenvid();
+	cycles = read_tsc() - start;
+	cprintf("int $0x%x: %llu cycles/call\n", T_SYSCALL, cycles / NCALL);
+
+	cpuid(1, 0, 0, 0, &edx);
+	if (!(edx & CPUID_FEAT_SEP)) {
+		cprintf("sysenter: not supported\n");
+		return;
+	}
+
+	// sys_getenvid takes the SYSENTER path when it is available.
+	start = read_tsc();
+	for (i = 0; i < NCALL; i++)
+		sys_getenvid();
+	cycles = read_tsc() - start;
+	cprintf("sysenter: %llu cycles/call\n", cycles / NCALL);
+}
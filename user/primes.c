@@ -7,18 +7,30 @@
 // Since NENVS is 1024, we can print 1022 primes before running out.
 // The remaining two environments are the integer generator at the bottom
 // of main and user/idle.
+//
+// Numbers flow through mailboxes, so each filter can run ahead of its
+// right neighbor by up to NSLOTS numbers and drains up to NBATCH of
+// them per system call.
 
 #include <inc/lib.h>
 
+#define NSLOTS	64
+#define NBATCH	32
+
 unsigned
 primeproc(void)
 {
-	int i, id, p;
-	envid_t envid;
+	int i, n, id, p;
+	struct Mboxmsg msgs[NBATCH];
 
 	// fetch a prime from our left neighbor
 top:
-	p = ipc_recv(&envid, 0, 0);
+	// our left neighbor may create our mailbox first
+	if ((n = sys_mbox_create(0, NSLOTS)) < 0)
+		panic("sys_mbox_create: %e", n);
+	if ((n = mbox_recv(msgs, NBATCH)) < 0)
+		panic("mbox_recv: %e", n);
+	p = msgs[0].mm_value;
 	cprintf("%d ", p);
 
 	// fork a right neighbor to continue the chain
@@ -26,12 +38,18 @@ top:
 		panic("fork: %e", id);
 	if (id == 0)
 		goto top;
+	if ((i = sys_mbox_create(id, NSLOTS)) < 0)
+		panic("sys_mbox_create: %e", i);
 	
 	// filter out multiples of our prime
+	i = 1;
 	while (1) {
-		i = ipc_recv(&envid, 0, 0);
-		if (i % p)
-			ipc_send(id, i, 0, 0);
+		for (; i < n; i++)
+			if (msgs[i].mm_value % p)
+				mbox_send(id, msgs[i].mm_value);
+		if ((n = mbox_recv(msgs, NBATCH)) < 0)
+			panic("mbox_recv: %e", n);
+		i = 0;
 	}
 }
 
@@ -45,9 +63,10 @@ umain(void)
 		panic("fork: %e", id);
 	if (id == 0)
 		primeproc();
+	if ((i = sys_mbox_create(id, NSLOTS)) < 0)
+		panic("sys_mbox_create: %e", i);
 
 	// feed all the integers through
 	for (i = 2; ; i++)
-		ipc_send(id, i, 0, 0);
+		mbox_send(id, i);
 }
-
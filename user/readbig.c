@@ -0,0 +1,52 @@
+// Big file streaming test and benchmark.
+// Writes a 6 MB file, which only fits on a disk with FS_FEAT_DINDIRECT,
+// then reads it back in 64 KB chunks, checking every word and
+// reporting the cycles the read took.
+
+#include <inc/x86.h>
+#include <inc/lib.h>
+
+#define FILESIZE	(6 * 1024 * 1024)
+#define CHUNK		(64 * 1024)
+
+static uint32_t buf[CHUNK / 4];
+
+void
+umain(void)
+{
+	int fd, r;
+	uint32_t i, j;
+	uint64_t start, cycles;
+
+	if ((fd = open("/bigfile", O_WRONLY | O_CREAT | O_TRUNC)) < 0)
+		panic("open /bigfile: %e", fd);
+	for (i = 0; i < FILESIZE; i += CHUNK) {
+		for (j = 0; j < CHUNK / 4; j++)
+			buf[j] = i + j * 4;
+		if ((r = write(fd, buf, CHUNK)) != CHUNK)
+			panic("write /bigfile at %d: %e", i, r);
+	}
+	close(fd);
+	sync();
+
+	start = read_tsc();
+	if ((fd = open("/bigfile", O_RDONLY)) < 0)
+		panic("open /bigfile: %e", fd);
+	for (i = 0; i < FILESIZE; i += CHUNK) {
+		if ((r = readn(fd, buf, CHUNK)) != CHUNK)
+			panic("read /bigfile at %d: %e", i, r);
+		for (j = 0; j < CHUNK / 4; j++)
+			if (buf[j] != i + j * 4)
+				panic("/bigfile at %d holds %08x", i + j * 4, buf[j]);
+	}
+	if ((r = readn(fd, buf, CHUNK)) != 0)
+		panic("read /bigfile past the end: got %d", r);
+	close(fd);
+	cycles = read_tsc() - start;
+	cprintf("readbig: %d KB in %llu cycles, %llu cycles/block\n",
+		FILESIZE / 1024, cycles, cycles / (FILESIZE / BLKSIZE));
+
+	if ((r = remove("/bigfile")) < 0)
+		panic("remove /bigfile: %e", r);
+	cprintf("readbig: OK\n");
+}
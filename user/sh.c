@@ -22,9 +22,9 @@ void
 runcmd(char* s)
 {
 	char *argv[MAXARGS], *t, argv0buf[BUFSIZ];
-	int argc, c, i, r, p[2], fd, pipe_child, bground;
+	int argc, c, i, r, p[2], fd, pipe_child, bground, status;
 
-	pipe_child = bground = 0;
+	pipe_child = bground = status = 0;
 	gettoken(s, 0);
 
 again:
@@ -199,8 +199,10 @@ runit:
 	}
 
 	// Spawn the command!
-	if ((r = spawn(argv0buf, (const char**) argv)) < 0)
+	if ((r = spawn(argv0buf, (const char**) argv)) < 0) {
 		cprintf("spawn %s: %e\n", argv[0], r);
+		status = r;
+	}
 
 	// In the parent, close all file descriptors and wait for the
 	// spawned command to exit.
@@ -209,9 +211,10 @@ runit:
 		if (debug)
 			cprintf("[%08x] WAIT %s %08x\n", env->env_id, argv[0], r);
 		if (!bground) {
-			wait(r);
+			status = wait(r);
 			if (debug)
-				cprintf("[%08x] wait finished\n", env->env_id);
+				cprintf("[%08x] wait finished, status %d\n",
+					env->env_id, status);
 		}
 	}
 
@@ -225,8 +228,8 @@ runit:
 			cprintf("[%08x] wait finished\n", env->env_id);
 	}
 
-	// Done!
-	exit();
+	// Done!  Exit with the command's status.
+	exit_status(status);
 }
 
 
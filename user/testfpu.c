@@ -0,0 +1,42 @@
+// Check that FPU state survives context switches.
+// Parent and child each keep a running sum in an x87 register
+// while yielding, so their FPU contexts interleave.
+
+#include <inc/lib.h>
+
+#define NSTEP	1000
+
+// Yield with 'v' held in st(0).  The compiler would spill FPU
+// registers around an ordinary call, so make the system call here.
+static double
+yield_holding(double v)
+{
+	int num = SYS_yield;
+
+	asm volatile("int %2"
+		: "=t" (v), "+a" (num)
+		: "i" (T_SYSCALL), "0" (v)
+		: "cc", "memory");
+	return v;
+}
+
+void
+umain(void)
+{
+	int i, who;
+	double x, step;
+
+	who = fork();
+	if (who < 0)
+		panic("fork: %e", who);
+
+	step = who ? 0.5 : 0.25;
+	x = 0;
+	for (i = 0; i < NSTEP; i++)
+		x = yield_holding(x + step);
+
+	if (x != NSTEP * step)
+		panic("%s: got %d/1000, expected %d/1000", who ? "parent" : "child",
+		      (int) (x * 1000), (int) (NSTEP * step * 1000));
+	cprintf("%s: fpu state is good\n", who ? "parent" : "child");
+}
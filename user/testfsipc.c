@@ -32,7 +32,7 @@ umain(void)
 		panic("serve_open returned size %d wanted %d\n", fd->fd_file.file.f_size, strlen(msg));
 	cprintf("serve_open is good\n");
 
-	if ((r = fsipc_map(fd->fd_file.id, 0, UTEMP)) < 0)
+	if ((r = fsipc_map(fd->fd_file.id, 0, 1, UTEMP)) < 0)
 		panic("serve_map: %e", r);
 	if (strecmp(UTEMP, msg) != 0)
 		panic("serve_map returned wrong data");
@@ -44,7 +44,7 @@ umain(void)
 	fileid = fd->fd_file.id;
 	sys_page_unmap(0, (void*) FVA);
 
-	if ((r = fsipc_map(fileid, 0, UTEMP)) != -E_INVAL)
+	if ((r = fsipc_map(fileid, 0, 1, UTEMP)) != -E_INVAL)
 		panic("serve_map does not handle stale fileids correctly");
 	cprintf("stale fileid is good\n");
 }
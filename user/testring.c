@@ -0,0 +1,109 @@
+// System call ring test and benchmark.
+// Maps and unmaps NPAGE pages NROUND times with one system call
+// each, then again through the ring with one sys_ring_enter per
+// round, checking every result and reporting the cycles per page.
+
+#include <inc/x86.h>
+#include <inc/lib.h>
+
+#define NPAGE	32
+#define NROUND	100
+
+#define RING	((struct Ring *) 0x0ffff000)
+#define SRCVA	((char *) 0x10000000)
+#define DSTVA	((char *) 0x10001000)
+
+static void
+submit(uint32_t num, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
+       uint32_t a5, uint32_t tag)
+{
+	struct Ringsqe sqe = { num, { a1, a2, a3, a4, a5 }, tag };
+	int r;
+
+	if ((r = ring_submit(RING, &sqe)) < 0)
+		panic("ring_submit: %e", r);
+}
+
+void
+umain(void)
+{
+	int i, j, r;
+	uint32_t ntag;
+	uint64_t start, cycles;
+	struct Ringcqe cqe;
+
+	if ((r = sys_page_alloc(0, SRCVA, PTE_P|PTE_U|PTE_W)) < 0)
+		panic("sys_page_alloc: %e", r);
+	strcpy(SRCVA, "ring");
+
+	start = read_tsc();
+	for (i = 0; i < NROUND; i++) {
+		for (j = 0; j < NPAGE; j++)
+			if ((r = sys_page_map(0, SRCVA, 0, DSTVA + j * PGSIZE,
+					      PTE_P|PTE_U|PTE_W)) < 0)
+				panic("sys_page_map: %e", r);
+		for (j = 0; j < NPAGE; j++)
+			sys_page_unmap(0, DSTVA + j * PGSIZE);
+	}
+	cycles = read_tsc() - start;
+	cprintf("direct: %llu cycles/page\n", cycles / (NROUND * NPAGE));
+
+	if ((r = ring_setup(RING)) < 0)
+		panic("ring_setup: %e", r);
+
+	ntag = 0;
+	start = read_tsc();
+	for (i = 0; i < NROUND; i++) {
+		for (j = 0; j < NPAGE; j++)
+			submit(SYS_page_map, 0, (uint32_t) SRCVA, 0,
+			       (uint32_t) (DSTVA + j * PGSIZE),
+			       PTE_P|PTE_U|PTE_W, ntag++);
+		for (j = 0; j < NPAGE; j++)
+			submit(SYS_page_unmap, 0,
+			       (uint32_t) (DSTVA + j * PGSIZE), 0, 0, 0,
+			       ntag++);
+		// A timer interrupt may already have run some of them.
+		if ((r = sys_ring_enter()) < 0)
+			panic("sys_ring_enter: %e", r);
+		for (j = 0; j < 2 * NPAGE; j++) {
+			if (!ring_complete(RING, &cqe))
+				panic("missing completion");
+			if (cqe.cqe_tag != ntag - 2 * NPAGE + j || cqe.cqe_res < 0)
+				panic("completion %d: tag %d res %e", j,
+				      cqe.cqe_tag, cqe.cqe_res);
+		}
+	}
+	cycles = read_tsc() - start;
+	cprintf("ring: %llu cycles/page\n", cycles / (NROUND * NPAGE));
+
+	// Calls that can block are refused.
+	submit(SYS_yield, 0, 0, 0, 0, 0, 0);
+	if (sys_ring_enter() < 0 || !ring_complete(RING, &cqe)
+	    || cqe.cqe_res != -E_INVAL)
+		panic("SYS_yield was not refused");
+
+	// Submissions run on the next trap even without sys_ring_enter.
+	submit(SYS_page_map, 0, (uint32_t) SRCVA, 0, (uint32_t) DSTVA,
+	       PTE_P|PTE_U, 0);
+	sys_yield();
+	if (!ring_complete(RING, &cqe) || cqe.cqe_res < 0
+	    || strcmp(DSTVA, "ring") != 0)
+		panic("submission not run on trap");
+
+	// The ring can't be mapped anywhere else or made read-only,
+	// and a child doesn't get it.
+	if (sys_page_map(0, RING, 0, DSTVA, PTE_P|PTE_U|PTE_W) != -E_INVAL
+	    || sys_page_map(0, RING, 0, RING, PTE_P|PTE_U) != -E_INVAL)
+		panic("ring page not kept private");
+	if ((r = fork()) < 0)
+		panic("fork: %e", r);
+	if (r == 0) {
+		if (envring || ((vpd[PDX(RING)] & PTE_P)
+				&& (vpt[VPN(RING)] & PTE_P)))
+			panic("child got the ring");
+		exit();
+	}
+	wait(r);
+
+	cprintf("ring OK\n");
+}
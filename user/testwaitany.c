@@ -0,0 +1,56 @@
+// Test sys_wait_any: time out, then wait for a signal, a message
+// and a child's exit, all from the same set.  Then check that wait()
+// gets a child's exit status.
+
+#include <inc/lib.h>
+
+void
+umain(void)
+{
+	int evid, r;
+	envid_t child;
+	struct Waitev evs[3];
+
+	if ((evid = sys_event_alloc()) < 0)
+		panic("sys_event_alloc: %e", evid);
+
+	evs[0] = (struct Waitev) { WAIT_EVENT, evid };
+	if ((r = sys_wait_any(evs, 1, 0)) != -E_TIMEOUT)
+		panic("poll of unsignaled event: %e", r);
+	if ((r = sys_wait_any(evs, 1, 5)) != -E_TIMEOUT)
+		panic("wait for unsignaled event: %e", r);
+
+	if ((child = fork()) < 0)
+		panic("fork: %e", child);
+	if (child == 0) {
+		sys_event_signal(evid);
+		ipc_send(env->env_parent_id, 0, 0, 0);
+		return;
+	}
+
+	evs[1] = (struct Waitev) { WAIT_IPC, 0 };
+	evs[2] = (struct Waitev) { WAIT_ENV, child };
+	if ((r = sys_wait_any(evs, 3, -1)) != 0)
+		panic("expected the signal, got %e", r);
+	if ((r = sys_wait_any(evs, 3, -1)) != 1)
+		panic("expected the message, got %e", r);
+	ipc_recv(0, 0, 0);
+	if ((r = sys_wait_any(evs, 3, -1)) != 2)
+		panic("expected the exit, got %e", r);
+
+	sys_event_free(evid);
+	if ((r = sys_wait_any(evs, 1, 0)) != -E_INVAL)
+		panic("wait for freed event: %e", r);
+
+	// wait() picks up the exit status, even after the exit.
+	if ((child = fork()) < 0)
+		panic("fork: %e", child);
+	if (child == 0)
+		exit_status(42);
+	if ((r = wait(child)) != 42)
+		panic("wait: status %d, expected 42", r);
+	if ((r = wait(child)) != 42)
+		panic("second wait: status %d, expected 42", r);
+
+	cprintf("wait_any OK\n");
+}
@@ -0,0 +1,42 @@
+// File creation benchmark.
+// Writes a new 4 MB file in 64 KB chunks, syncs it to disk, and
+// reports the cycles taken and the file server's cache counters.
+
+#include <inc/x86.h>
+#include <inc/lib.h>
+
+#define FILESIZE	(4 * 1024 * 1024)
+#define CHUNK		(64 * 1024)
+
+static char buf[CHUNK];
+
+void
+umain(void)
+{
+	int fd, i, r;
+	uint64_t start, cycles;
+	struct Fsstats st;
+
+	for (i = 0; i < CHUNK; i++)
+		buf[i] = i;
+
+	start = read_tsc();
+	if ((fd = open("/bigfile", O_WRONLY | O_CREAT | O_TRUNC)) < 0)
+		panic("open /bigfile: %e", fd);
+	for (i = 0; i < FILESIZE; i += CHUNK)
+		if ((r = write(fd, buf, CHUNK)) != CHUNK)
+			panic("write /bigfile at %d: %e", i, r);
+	close(fd);
+	sync();
+	cycles = read_tsc() - start;
+	cprintf("writebig: %d KB in %llu cycles, %llu cycles/block\n",
+		FILESIZE / 1024, cycles, cycles / (FILESIZE / BLKSIZE));
+
+	if ((r = fsipc_stats(&st)) == 0)
+		cprintf("writebig: hits %u misses %u evictions %u writebacks %u\n",
+			st.st_hits, st.st_misses, st.st_evictions,
+			st.st_writebacks);
+
+	if ((r = remove("/bigfile")) < 0)
+		panic("remove /bigfile: %e", r);
+}